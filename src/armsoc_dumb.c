@@ -426,8 +426,30 @@ int armsoc_bo_cpu_prep(struct armsoc_bo *bo, enum armsoc_gem_op op)
 
 int armsoc_bo_cpu_fini(struct armsoc_bo *bo, enum armsoc_gem_op op)
 {
+	return armsoc_bo_cpu_fini_range(bo, op, 0, bo->size);
+}
+
+/* end CPU access that only touched [offset, offset + size) of the bo */
+int armsoc_bo_cpu_fini_range(struct armsoc_bo *bo, enum armsoc_gem_op op,
+				uint32_t offset, uint32_t size)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint32_t start, end;
+
 	assert(bo->refcnt > 0);
-	return msync(bo->map_addr, bo->size, MS_SYNC | MS_INVALIDATE);
+	/* nothing written, nothing to write back */
+	if (op == ARMSOC_GEM_READ || size == 0)
+		return 0;
+
+	if (offset >= bo->size)
+		return 0;
+	if (size > bo->size - offset)
+		size = bo->size - offset;
+
+	start = offset & ~(page_size - 1);
+	end = offset + size;
+	return msync((char *)bo->map_addr + start, end - start,
+	             MS_SYNC | MS_INVALIDATE);
 }
 
 int armsoc_bo_add_fb(struct armsoc_bo *bo)
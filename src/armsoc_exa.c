@@ -38,7 +38,9 @@
 //#define ARMSOC_BO_MIN_SIZE (1024 * 1024)
 //#define ARMSOC_BO_MIN_SIZE 0
 
-//#define ARMSOC_EXA_MAP_USERPTR 1
+#define ARMSOC_EXA_MAP_USERPTR 1
+#define ARMSOC_ACCESS_DAMAGE_MIN 4 /* CPU writes to a dumb pixmap before its written rows are tracked */
+#define ARMSOC_ACCESS_DAMAGE_IDLE_MS 1000 /* without CPU write since, tracking stops */
 
 //#define ARMSOC_EXA_DEBUG 1
 
@@ -200,6 +202,8 @@ ARMSOCCreatePixmap2(ScreenPtr pScreen, int width, int height,
 		return CreateExaPixmap(priv, pScreen, width, height, depth, usage_hint, bitsPerPixel, new_fb_pitch);
 }
 
+static void ARMSOCAccessDamageStop(struct ARMSOCPixmapPrivRec *priv);
+
 _X_EXPORT void
 ARMSOCDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 {
@@ -209,6 +213,9 @@ ARMSOCDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 
 	assert(!priv->ext_access_cnt);
 
+	TimerFree(priv->access_timer);
+	ARMSOCAccessDamageStop(priv);
+
 	/* If ModifyPixmapHeader failed, it's possible we don't have a bo
 	 * backing this pixmap. */
 	if (priv->bo) {
@@ -302,8 +309,11 @@ ModifyExaPixmapHeader(struct ARMSOCPixmapPrivRec *priv, PixmapPtr pPixmap, int w
 		INFO_MSG("ModifyExaPixmapHeader %p pPixData(%p) != priv->buf.buf(%p) %dx%d %d %d/%d", pPixmap, pPixData, priv->buf.buf, width, height, devKind, bitsPerPixel, depth);
 #endif
 		if (pPixData != priv->buf.buf || priv->buf.size != size) {
-			if (priv->buf.buf && pARMSOC->pARMSOCEXA->UnmapUsermemBuf) {
-				pARMSOC->pARMSOCEXA->UnmapUsermemBuf(pARMSOC->pARMSOCEXA, &priv->buf);
+			if (priv->buf.buf) {
+				if (priv->buf.usermem && pARMSOC->pARMSOCEXA->UnmapUsermemBuf)
+					pARMSOC->pARMSOCEXA->UnmapUsermemBuf(pARMSOC->pARMSOCEXA, &priv->buf);
+				else
+					pARMSOC->pARMSOCEXA->FreeBuf(pARMSOC->pARMSOCEXA, &priv->buf);
 			}
 
 			if (pARMSOC->pARMSOCEXA->MapUsermemBuf && pARMSOC->pARMSOCEXA->MapUsermemBuf(pARMSOC->pARMSOCEXA, width, height, devKind, pPixData, &priv->buf)) {
@@ -580,6 +590,94 @@ static inline enum armsoc_gem_op idx2op(int index)
 	return TRUE;
 }
 
+static void
+ARMSOCAccessDamageDestroy(DamagePtr pDamage, void *closure)
+{
+	struct ARMSOCPixmapPrivRec *priv = closure;
+
+	priv->access_damage = NULL;
+}
+
+static void
+ARMSOCAccessDamageStop(struct ARMSOCPixmapPrivRec *priv)
+{
+	DamagePtr damage = priv->access_damage;
+
+	if (!damage)
+		return;
+
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1,16,99,901,0)
+	DamageUnregister(damage);
+#else
+	DamageUnregister(priv->access_drawable, damage);
+#endif
+	/* clears priv->access_damage through the destroy callback */
+	DamageDestroy(damage);
+}
+
+/* no CPU write for a while, stop paying the damage on every drawing op */
+static CARD32
+ARMSOCAccessDamageIdle(OsTimerPtr timer, CARD32 time, void *arg)
+{
+	ARMSOCAccessDamageStop(arg);
+	return 0;
+}
+
+/* Write back only the rows rendering may have touched since the previous
+ * CPU access, as recorded by a damage on the pixmap. The damage is only
+ * registered on pixmaps the CPU keeps writing, ARMSOC_ACCESS_DAMAGE_MIN
+ * writes close together, and removed once they stop; the other accesses
+ * sync the whole bo.
+ */
+static void
+ARMSOCFinishDumbAccess(PixmapPtr pPixmap, struct ARMSOCPixmapPrivRec *priv,
+		enum armsoc_gem_op op)
+{
+	uint32_t pitch = armsoc_bo_pitch(priv->bo);
+	CARD32 now;
+	BoxPtr extents;
+	int y1, y2;
+
+	/* reads leave the recorded damage to the next write */
+	if (op == ARMSOC_GEM_READ) {
+		armsoc_bo_cpu_fini_range(priv->bo, op, 0, 0);
+		return;
+	}
+
+	now = GetTimeInMillis();
+	if (now - priv->access_time > ARMSOC_ACCESS_DAMAGE_IDLE_MS)
+		priv->access_writes = 0;
+	priv->access_time = now;
+	priv->access_writes++;
+
+	if (!priv->access_damage) {
+		armsoc_bo_cpu_fini(priv->bo, op);
+		if (priv->access_writes < ARMSOC_ACCESS_DAMAGE_MIN)
+			return;
+
+		priv->access_damage = DamageCreate(NULL, ARMSOCAccessDamageDestroy,
+				DamageReportNone, TRUE, pPixmap->drawable.pScreen, priv);
+		if (!priv->access_damage)
+			return;
+		priv->access_drawable = &pPixmap->drawable;
+		DamageRegister(&pPixmap->drawable, priv->access_damage);
+	} else {
+		extents = RegionExtents(DamageRegion(priv->access_damage));
+		y1 = max(extents->y1, 0);
+		y2 = min(extents->y2, (int)pPixmap->drawable.height);
+
+		if (y1 < y2)
+			armsoc_bo_cpu_fini_range(priv->bo, op, y1 * pitch, (y2 - y1) * pitch);
+		else
+			armsoc_bo_cpu_fini_range(priv->bo, op, 0, 0);
+
+		DamageEmpty(priv->access_damage);
+	}
+
+	priv->access_timer = TimerSet(priv->access_timer, 0,
+			ARMSOC_ACCESS_DAMAGE_IDLE_MS, ARMSOCAccessDamageIdle, priv);
+}
+
 /**
  * FinishAccess() is called after CPU access to an offscreen pixmap.
  *
@@ -597,12 +695,8 @@ ARMSOCFinishAccess(PixmapPtr pPixmap, int index)
 
 	pPixmap->devPrivate.ptr = NULL;
 
-	/* NOTE: can we use EXA migration module to track which parts of the
-	 * buffer was accessed by sw, and pass that info down to kernel to
-	 * do a more precise cache flush..
-	 */
 	if (IsDumbPixmap(priv, pPixmap->drawable.width * pPixmap->drawable.height * (pPixmap->drawable.bitsPerPixel / 8)))
-		armsoc_bo_cpu_fini(priv->bo, idx2op(index));
+		ARMSOCFinishDumbAccess(pPixmap, priv, idx2op(index));
 }
 
 /**
@@ -37,6 +37,7 @@
 #include "xf86.h"
 #include "xf86_OSproc.h"
 #include "exa.h"
+#include "damage.h"
 #include "compat-api.h"
 
 struct ARMSOCEXABuf {
@@ -45,6 +46,7 @@ struct ARMSOCEXABuf {
 	int pitch;
 	void *priv;
 	int usermem;
+	int cached; // CPU cached bo, not shared with the write combined ones
 };
 
 /**
@@ -140,6 +142,15 @@ struct ARMSOCPixmapPrivRec {
 	void *unaccel_priv;
 	*/
 	int usage_hint;
+	/* Rendering to a dumb pixmap since its last CPU access, the
+	 * range written back when the access ends. Only registered while
+	 * the CPU keeps writing the pixmap.
+	 */
+	DamagePtr access_damage;
+	DrawablePtr access_drawable;
+	OsTimerPtr access_timer;
+	CARD32 access_time;
+	int access_writes;
 };
 
 Bool is_dumb_pixmap(struct ARMSOCPixmapPrivRec *priv, int size);
@@ -38,6 +38,14 @@ static queue_t *unused_bos;
 #define CACHE_DEBUG_MSG(fmt, ...)
 #endif
 
+#ifdef ETNA_USERPTR_DEBUG
+#define USERPTR_DEBUG_MSG(fmt, ...) \
+		do { xf86Msg(X_INFO, fmt "\n",\
+				##__VA_ARGS__); } while (0)
+#else
+#define USERPTR_DEBUG_MSG(fmt, ...)
+#endif
+
 static inline void get_abs_timeout(struct drm_etnaviv_timespec *tv, uint64_t ns)
 {
 	struct timespec t;
@@ -338,7 +346,7 @@ struct etna_bo *etna_bo_from_usermem_prot(struct etna_device *dev, void *memory,
 		usr_bo = bo_from_handle(dev, size, req.handle, flags);
 //		usr_bo->map = memory;
 
-		INFO_MSG("etna_bo_from_usermem_prot success : mem:%p bo:%p handle:%d size:%d", memory, usr_bo, req.handle, size);
+		USERPTR_DEBUG_MSG("etna_bo_from_usermem_prot success : mem:%p bo:%p handle:%d size:%d", memory, usr_bo, req.handle, size);
 		return usr_bo;
 	}
 #else
@@ -360,7 +368,7 @@ struct etna_bo *etna_bo_from_usermem_prot(struct etna_device *dev, void *memory,
 		usr_bo = etna_bo_from_handle(dev, req.handle, size);
 //		usr_bo->map = memory;
 
-		INFO_MSG("etna_bo_from_usermem_prot success : mem:%p bo:%p handle:%d size:%d", memory, usr_bo, req.handle, size);
+		USERPTR_DEBUG_MSG("etna_bo_from_usermem_prot success : mem:%p bo:%p handle:%d size:%d", memory, usr_bo, req.handle, size);
 		return usr_bo;
 	}
 #endif
@@ -65,6 +65,18 @@
 #define ROP_DST_OR_SRC 			0xee
 #define ROP_WHITE 				0xff
 
+#define ROP_PAT 				0xf0
+#define ROP_DST_AND_NOT_PAT 	0x0a
+#define ROP_PAT_OR_DST 			0xfa
+
+// GPU feature words, bits from the etnaviv common.xml
+#define VIV2D_FEATURE_WORDS 4
+// ETNA_GPU_FEATURES_1 (chipMinorFeatures0)
+#define VIV2D_FEATURE_2DPE20			0x00000080
+#define VIV2D_FEATURE_2D_A8_TARGET		0x20000000
+// ETNA_GPU_FEATURES_3 (chipMinorFeatures2)
+#define VIV2D_FEATURE_2D_MULTI_SOURCE_BLIT	0x00200000
+
 typedef struct _Viv2DRect {
 	int x1;
 	int y1;
@@ -94,9 +106,16 @@ typedef struct {
 	int pitch;
 	Viv2DFormat format;
 	Bool tiled;
+	int offset; // of the first pixel in bo, non zero for tile views
 
 	struct ARMSOCPixmapPrivRec *armsocPix; // armsoc pixmap ref
 	int refcnt;
+
+	Bool has_color; // whole pixmap is known to be color
+	CARD32 color; // pixel value
+
+	int cpu_score; // CPU accesses against GPU writes, picks cached or write combined bo
+	Bool usermem; // bo wraps client memory
 } Viv2DPixmapPrivRec, *Viv2DPixmapPrivPtr;
 
 typedef struct _Viv2DBlendOp {
@@ -117,6 +136,9 @@ typedef struct _Viv2DOp {
 
 	Bool has_mask;
 	Bool has_component_alpha;
+	Bool solid_msk; // solid src IN A8 mask in one pass
+	Bool split; // surfaces over VIV2D_HW_MAX_SIZE, rects are streamed per tile
+	Bool pending; // composite states and rects kept open after DoneComposite
 	
 	int src_type;
 	int msk_type;
@@ -141,6 +163,13 @@ typedef struct _Viv2DOp {
 	Viv2DFormat msk_fmt;
 	Viv2DFormat src_fmt;
 
+	// compared by the next PrepareComposite when pending
+	int dst_exa_fmt;
+	struct etna_bo *src_bo;
+	struct etna_bo *msk_bo;
+	Bool src_repeat;
+	Bool msk_repeat;
+
 	int prev_src_x;
 	int prev_src_y;
 	int prev_width;
@@ -150,6 +179,41 @@ typedef struct _Viv2DOp {
 
 } Viv2DOp;
 
+// fast paths of this GPU, built from its feature words at init
+typedef struct _Viv2DCaps {
+	Bool pe20; // color multiply modes and COLOR blend modes
+	Bool a8_dst; // A8 render target
+	Bool multi_source; // several sources blended in one blit
+} Viv2DCaps;
+
+// write combined bos PutImage data is staged in before the blit
+typedef struct _Viv2DUploadRing {
+	struct etna_bo *bo[VIV2D_UPLOAD_SLOTS];
+	int next;
+} Viv2DUploadRing;
+
+// cached bos DownloadFromScreen reads the engine copies back from
+typedef struct _Viv2DReadbackPool {
+	struct etna_bo *bo[VIV2D_READBACK_SLOTS];
+} Viv2DReadbackPool;
+
+// client memory bos the stream used since clients last got output
+typedef struct _Viv2DUsermemSet {
+	struct etna_bo **bo;
+	int count;
+	int size;
+} Viv2DUsermemSet;
+
+// measured at init, used to pick the CPU or the GPU per operation
+typedef struct _Viv2DCost {
+	uint32_t cpu_write_ps; // per byte written
+	uint32_t cpu_read_ps; // per byte read from a WC bo
+	uint32_t gpu_ps; // per byte written by the engine
+	uint32_t sync_ns; // submit and wait latency
+	uint64_t queued_ns; // estimated engine time not yet retired
+	uint32_t queued_ts; // stream timestamp queued_ns belongs to
+} Viv2DCost;
+
 typedef struct _Viv2DRec {
 	int fd;
 	char *render_node;
@@ -163,6 +227,23 @@ typedef struct _Viv2DRec {
 	struct etna_bo *bo;
 	int width;
 	int height;
+
+	CreateGCProcPtr CreateGC;
+
+	CompositeProcPtr Composite;
+	struct _Viv2DGradientCache *gradients;
+	struct _Viv2DCapture *capture;
+	struct _Viv2DGlyphCache *glyphs;
+	struct _Viv2DTrapMask *trap_mask;
+	struct _Viv2DDefer *defer;
+
+	Viv2DCost cost;
+
+	Viv2DCaps caps;
+
+	Viv2DUploadRing upload;
+	Viv2DReadbackPool readback;
+	Viv2DUsermemSet usermem;
 } Viv2DRec, *Viv2DPtr;
 
 
@@ -0,0 +1,348 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "servermd.h"
+#include "damage.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+#include "viv2d_op.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_CAPTURE
+
+/*
+VNC servers and screen recorders call GetImage or ShmGetImage on the root
+window every frame, which reads the whole write combined scanout with the CPU.
+GetImage is wrapped: root window reads are served from cached shadow copies of
+the screen pixmap. A Damage on the screen pixmap records what changed, only
+those boxes are blitted into a shadow. There are two shadows: a read is served
+without waiting from the newest one the engine has retired, as long as no
+damage it misses covers the read rect, then the damage is queued into the other
+one for the next read. Otherwise the damage is blitted into the newest shadow
+and the read waits for it, a client never gets pixels older than its own
+drawing. While a client keeps reading, the damage is also blitted at each
+flush to the clients, so that the next read usually finds a shadow ready.
+*/
+
+#define VIV2D_CAPTURE_IDLE_MS 1000 // no read since, the shadows are not kept up to date at flush
+#define VIV2D_CAPTURE_SHADOWS 2
+
+typedef struct _Viv2DCaptureShadow {
+	Viv2DPixmapPrivRec pix;
+	RegionRec stale; // screen damage not blitted into this shadow yet
+	CARD32 seq; // update the shadow is up to date with, once retired
+} Viv2DCaptureShadow;
+
+typedef struct _Viv2DCapture {
+	GetImageProcPtr GetImage;
+	PixmapPtr pixmap; // screen pixmap the damage is registered on
+	DamagePtr damage;
+	Viv2DCaptureShadow shadow[VIV2D_CAPTURE_SHADOWS];
+	CARD32 seq;
+	CARD32 last_read;
+} Viv2DCaptureRec, *Viv2DCapturePtr;
+
+/* the damage layer destroys the damage with the pixmap, on screen resize */
+static void Viv2DCaptureDamageDestroy(DamagePtr pDamage, void *closure) {
+	Viv2DCapturePtr cap = closure;
+
+	cap->damage = NULL;
+	cap->pixmap = NULL;
+}
+
+static void Viv2DCaptureStop(Viv2DCapturePtr cap) {
+	int i;
+
+	if (cap->damage) {
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(1,16,99,901,0)
+		DamageUnregister(cap->damage);
+#else
+		DamageUnregister(&cap->pixmap->drawable, cap->damage);
+#endif
+		DamageDestroy(cap->damage);
+		cap->damage = NULL;
+	}
+
+	for (i = 0; i < VIV2D_CAPTURE_SHADOWS; i++) {
+		Viv2DCaptureShadow *shadow = &cap->shadow[i];
+
+		if (shadow->pix.bo) {
+			etna_bo_del(shadow->pix.bo);
+			RegionUninit(&shadow->stale);
+		}
+		memset(shadow, 0, sizeof(*shadow));
+	}
+	cap->pixmap = NULL;
+}
+
+/* blit boxes of the screen pixmap at the same place in a shadow */
+static void Viv2DCaptureBlit(Viv2DPtr v2d, Viv2DCapturePtr cap, Viv2DCaptureShadow *shadow, BoxPtr pbox, int nbox) {
+	Viv2DPixmapPrivPtr scr = Viv2DPixmapPrivFromPixmap(cap->pixmap);
+	Viv2DRect rect;
+	int i;
+
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES);
+	_Viv2DStreamSrc(v2d, scr);
+	_Viv2DStreamDst(v2d, &shadow->pix, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+
+	for (i = 0; i < nbox; i++) {
+		rect.x1 = pbox[i].x1;
+		rect.y1 = pbox[i].y1;
+		rect.x2 = pbox[i].x2;
+		rect.y2 = pbox[i].y2;
+		_Viv2DStreamCompRects(v2d, viv2d_src_pix, rect.x1, rect.y1,
+		                      rect.x2 - rect.x1, rect.y2 - rect.y1, &rect, 1);
+	}
+}
+
+/* queue the damage a shadow misses, it is up to date once the blit retires */
+static void Viv2DCaptureUpdate(Viv2DPtr v2d, Viv2DCapturePtr cap, Viv2DCaptureShadow *shadow) {
+	RegionPtr damage = DamageRegion(cap->damage);
+	int i;
+
+	if (RegionNotEmpty(damage)) {
+		for (i = 0; i < VIV2D_CAPTURE_SHADOWS; i++)
+			RegionUnion(&cap->shadow[i].stale, &cap->shadow[i].stale, damage);
+		DamageEmpty(cap->damage);
+	}
+
+	if (RegionNotEmpty(&shadow->stale)) {
+		Viv2DCaptureBlit(v2d, cap, shadow, RegionRects(&shadow->stale), RegionNumRects(&shadow->stale));
+		RegionEmpty(&shadow->stale);
+	}
+	shadow->seq = ++cap->seq;
+}
+
+/* the engine is done writing the shadow, tested without waiting */
+static Bool Viv2DCaptureRetired(Viv2DCaptureShadow *shadow) {
+	if (!etna_bo_ready(shadow->pix.bo))
+		return FALSE;
+	if (etna_bo_cpu_prep(shadow->pix.bo, DRM_ETNA_PREP_READ | DRM_ETNA_PREP_NOSYNC))
+		return FALSE;
+	etna_bo_cpu_fini(shadow->pix.bo);
+	return TRUE;
+}
+
+/* the shadow misses damage in box, blitted or not yet recorded */
+static Bool Viv2DCaptureStale(Viv2DCapturePtr cap, Viv2DCaptureShadow *shadow, BoxPtr box) {
+	return RegionContainsRect(&shadow->stale, box) != rgnOUT ||
+	       RegionContainsRect(DamageRegion(cap->damage), box) != rgnOUT;
+}
+
+static inline Viv2DCaptureShadow *Viv2DCaptureOlder(Viv2DCapturePtr cap) {
+	return cap->shadow[0].seq <= cap->shadow[1].seq ? &cap->shadow[0] : &cap->shadow[1];
+}
+
+static inline Viv2DCaptureShadow *Viv2DCaptureOther(Viv2DCapturePtr cap, Viv2DCaptureShadow *shadow) {
+	return shadow == &cap->shadow[0] ? &cap->shadow[1] : &cap->shadow[0];
+}
+
+/* shadows and damage are only created once a client reads the screen */
+static Bool Viv2DCaptureStart(ScreenPtr pScreen, Viv2DPtr v2d, Viv2DCapturePtr cap) {
+	PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+	Viv2DPixmapPrivPtr scr = Viv2DPixmapPrivFromPixmap(pPixmap);
+	BoxRec box = {0, 0, pPixmap->drawable.width, pPixmap->drawable.height};
+	int i;
+
+	if (cap->damage && cap->pixmap == pPixmap)
+		return TRUE;
+
+	Viv2DCaptureStop(cap);
+
+	if (!scr || !scr->bo || _Viv2DPixIsLarge(scr))
+		return FALSE;
+
+	if (!_Viv2DSetFormat(pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel, &scr->format))
+		return FALSE;
+
+	for (i = 0; i < VIV2D_CAPTURE_SHADOWS; i++) {
+		Viv2DCaptureShadow *shadow = &cap->shadow[i];
+
+		shadow->pix.width = pPixmap->drawable.width;
+		shadow->pix.height = pPixmap->drawable.height;
+		shadow->pix.pitch = ALIGN(pPixmap->drawable.width * pPixmap->drawable.bitsPerPixel / 8, VIV2D_PITCH_ALIGN);
+		shadow->pix.format = scr->format;
+		shadow->pix.bo = etna_bo_new(v2d->dev, shadow->pix.pitch * shadow->pix.height, ETNA_BO_CACHED);
+		if (!shadow->pix.bo) {
+			Viv2DCaptureStop(cap);
+			return FALSE;
+		}
+		RegionInit(&shadow->stale, &box, 1);
+	}
+
+	cap->damage = DamageCreate(NULL, Viv2DCaptureDamageDestroy, DamageReportNone, TRUE, pScreen, cap);
+	if (!cap->damage) {
+		Viv2DCaptureStop(cap);
+		return FALSE;
+	}
+	cap->pixmap = pPixmap;
+	DamageRegister(&pPixmap->drawable, cap->damage);
+
+	Viv2DCaptureUpdate(v2d, cap, &cap->shadow[0]);
+	return TRUE;
+}
+
+static Bool Viv2DCaptureRead(DrawablePtr pDrawable, int x, int y, int w, int h,
+                             unsigned int format, unsigned long planeMask, char *d) {
+	ScreenPtr pScreen = pDrawable->pScreen;
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DCapturePtr cap = v2d->capture;
+	Viv2DCaptureShadow *shadow, *older;
+	BoxRec box;
+	int bpp = pDrawable->bitsPerPixel;
+	unsigned long full = pDrawable->depth < 32 ? (1UL << pDrawable->depth) - 1 : 0xffffffff;
+	int row_size, dst_pitch, i;
+	char *src;
+
+	if (pDrawable->type != DRAWABLE_WINDOW || ((WindowPtr)pDrawable)->parent)
+		return FALSE;
+
+	if (format != ZPixmap || (planeMask & full) != full || bpp < 8)
+		return FALSE;
+
+	if (x < 0 || y < 0 || x + w > pDrawable->width || y + h > pDrawable->height)
+		return FALSE;
+
+	if (!Viv2DCaptureStart(pScreen, v2d, cap))
+		return FALSE;
+
+	box.x1 = pDrawable->x + x;
+	box.y1 = pDrawable->y + y;
+	box.x2 = box.x1 + w;
+	box.y2 = box.y1 + h;
+
+	// the newest retired shadow up to date in box, else the newest one, updated and waited for
+	older = Viv2DCaptureOlder(cap);
+	shadow = Viv2DCaptureOther(cap, older);
+	if (!Viv2DCaptureRetired(shadow) || Viv2DCaptureStale(cap, shadow, &box)) {
+		// never updated yet, its contents are undefined
+		if (older->seq && Viv2DCaptureRetired(older) && !Viv2DCaptureStale(cap, older, &box))
+			shadow = older;
+		else
+			Viv2DCaptureUpdate(v2d, cap, shadow);
+	}
+
+	if (!etna_bo_ready(shadow->pix.bo))
+		_Viv2DStreamCommit(v2d, TRUE);
+
+	row_size = w * bpp / 8;
+	dst_pitch = PixmapBytePad(w, pDrawable->depth);
+
+	etna_bo_cpu_prep(shadow->pix.bo, DRM_ETNA_PREP_READ);
+	src = (char *)etna_bo_map(shadow->pix.bo) + (pDrawable->y + y) * shadow->pix.pitch + (pDrawable->x + x) * bpp / 8;
+	for (i = 0; i < h; i++) {
+		memcpy(d, src, row_size);
+		d += dst_pitch;
+		src += shadow->pix.pitch;
+	}
+	etna_bo_cpu_fini(shadow->pix.bo);
+
+	// the next read gets the damage through the other shadow
+	Viv2DCaptureUpdate(v2d, cap, Viv2DCaptureOther(cap, shadow));
+	_Viv2DStreamCommit(v2d, TRUE);
+
+	cap->last_read = GetTimeInMillis();
+	return TRUE;
+}
+
+static void Viv2DCaptureGetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+                                 unsigned int format, unsigned long planeMask, char *d) {
+	ScreenPtr pScreen = pDrawable->pScreen;
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DCapturePtr cap = v2d->capture;
+
+	if (Viv2DCaptureRead(pDrawable, x, y, w, h, format, planeMask, d))
+		return;
+
+	pScreen->GetImage = cap->GetImage;
+	pScreen->GetImage(pDrawable, x, y, w, h, format, planeMask, d);
+	cap->GetImage = pScreen->GetImage;
+	pScreen->GetImage = Viv2DCaptureGetImage;
+}
+
+/* called before the stream is committed at flush to the clients */
+void Viv2DCaptureFlush(Viv2DPtr v2d) {
+	Viv2DCapturePtr cap = v2d->capture;
+
+	if (!cap || !cap->damage)
+		return;
+
+	if (GetTimeInMillis() - cap->last_read > VIV2D_CAPTURE_IDLE_MS)
+		return;
+
+	Viv2DCaptureUpdate(v2d, cap, Viv2DCaptureOlder(cap));
+}
+
+Bool Viv2DCaptureScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+
+	v2d->capture = calloc(1, sizeof(*v2d->capture));
+	if (!v2d->capture)
+		return FALSE;
+
+	v2d->capture->GetImage = pScreen->GetImage;
+	pScreen->GetImage = Viv2DCaptureGetImage;
+
+	return TRUE;
+}
+
+void Viv2DCaptureScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DCapturePtr cap = v2d->capture;
+
+	if (!cap)
+		return;
+
+	Viv2DCaptureStop(cap);
+
+	if (cap->GetImage && pScreen->GetImage == Viv2DCaptureGetImage)
+		pScreen->GetImage = cap->GetImage;
+
+	free(cap);
+	v2d->capture = NULL;
+}
+#endif
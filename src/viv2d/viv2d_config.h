@@ -2,6 +2,15 @@
 #define VIV2D_STREAM_SIZE 1024*32
 #define VIV2D_MAX_RECTS 256
 #define VIV2D_PITCH_ALIGN 32
+#define VIV2D_ADDRESS_ALIGN 64 // tile views base address alignment
+#define VIV2D_HW_MAX_SIZE 2048 // largest surface the engine is given, bigger ones are split in tiles
+#define VIV2D_MAX_WIDTH 8192 // EXA limits
+#define VIV2D_MAX_HEIGHT 8192
+#define VIV2D_UPLOAD_SLOTS 4 // UploadToScreen staging bos, reused round robin
+#define VIV2D_UPLOAD_SLOT_SIZE 1024*1024
+#define VIV2D_READBACK_SLOTS 2 // DownloadFromScreen cached bos, one is read while the other is written
+#define VIV2D_READBACK_SLOT_SIZE 1024*1024
+#define VIV2D_CACHED_SCORE 8 // CPU access score moving a pixmap to a cached bo, and back to write combined at the opposite
 
 // EXA config
 #define VIV2D_MARKER 1
@@ -12,6 +21,18 @@
 #define VIV2D_COPY 1
 #define VIV2D_COMPOSITE 1
 #define VIV2D_PUT_TEXTURE_IMAGE 1
+#define VIV2D_GC 1 // accelerated core GC ops
+#define VIV2D_FILL_PATTERN 1 // 8x8 stipple and tile fills with the pattern brush
+#define VIV2D_LINES 1 // zero width solid lines with the LINE command
+#define VIV2D_GRADIENT_CACHE 1 // gradient sources rasterised once into pixmaps
+#define VIV2D_CAPTURE 1 // root window GetImage served from a damage tracked shadow
+#define VIV2D_GLYPH_ATLAS 1 // glyph strings drawn from driver atlases, without mask
+#define VIV2D_TRAPEZOID_MASK 1 // trapezoid and triangle masks rasterised in cached memory, composited on the GPU
+#define VIV2D_DEFER_ACCESS 1 // GetImage and ShmGetImage of busy pixmaps waits for the engine fence in the main loop
+#define VIV2D_TRAPEZOID_RECTS 1 // pixel aligned trapezoids composited as rects, with VIV2D_TRAPEZOID_MASK
+#define VIV2D_COST_MODEL 1 // small operations on busy pixmaps are left to the CPU
+#define VIV2D_COMPOSITE_BATCH 1 // compatible composites share states and DRAW_2D
+#define VIV2D_COPY_SRC_RELATIVE 1 // copy rects with the same offset in one DRAW_2D
 
 #define VIV2D_MASK_SUPPORT 1 // support mask
 #define VIV2D_REPEAT 1 // support repeat
@@ -21,15 +42,18 @@
 #define VIV2D_SUPPORT_A8_SRC 1
 #define VIV2D_SOLID_PICTURE_MSK 1 // support solid clear picture
 #define VIV2D_SUPPORT_A8_MASK 1
+#define VIV2D_SOLID_A8_MASK 1 // solid src with A8 mask in one pass
+#define VIV2D_MULTI_SOURCE 1 // src IN mask in one multi source blit when the GPU has it
 
 // EXPERIMENTAL
 #define VIV2D_PREPARE_SET_FORMAT 1
 //#define VIV2D_SOLID_FILL_BRUSH 1
-//#define VIV2D_SUPPORT_A8_DST 1
-//#define VIV2D_SUPPORT_MONO 1
-//#define VIV2D_UPLOAD_TO_SCREEN 1
-//#define VIV2D_DOWNLOAD_FROM_SCREEN 1
-//#define VIV2D_USERPTR 1
+#define VIV2D_SUPPORT_A8_DST 1 // A8 destination for Clear, Src, Over and Add
+#define VIV2D_SUPPORT_MONO 1 // mono expansion for core text and PushPixels
+#define VIV2D_UPLOAD_TO_SCREEN 1 // through the staging ring
+#define VIV2D_DOWNLOAD_FROM_SCREEN 1 // through cached readback bos
+#define VIV2D_USERPTR 1 // big PutImage blitted from the request buffer
+#define VIV2D_CACHED_PIXMAPS 1 // pixmaps the CPU keeps reading migrate to cached bos
 //#define VIV2D_COPY_BLEND 1
 #define VIV2D_MASK_COMPONENT_SUPPORT 1
 #define VIV2D_FLUSH_CALLBACK 1
@@ -37,11 +61,12 @@
 #define VIV2D_EXA_HACK 1
 
 // CPU only for surface < VIV2D_MIN_SIZE and > VIV2D_MAX_SIZE
-#define VIV2D_MAX_SIZE 2048*2048*4 // 16Mbytes
+#define VIV2D_MAX_SIZE 8192*4096*4 // 128Mbytes
 #define VIV2D_MIN_SIZE 0 // best result because less cpu-gpu exchange
 //#define VIV2D_MIN_SIZE 1024 // > 16x16 32bpp
 //#define VIV2D_MIN_SIZE 1024*4 // > 32x32 32bpp
 //#define VIV2D_MIN_SIZE 1024*16 // > 64x64 32bpp
+#define VIV2D_USERPTR_MIN_SIZE 1024*64 // smaller client memory is cheaper to copy than to pin
 
 //#define VIV2D_UNSUPPORTED 1
 //#define VIV2D_DEBUG 1
@@ -0,0 +1,219 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+#include "viv2d_op.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_COST_MODEL
+
+/*
+The GC320 is not always faster than the CPU: every operation pays the stream
+setup, and an operation touching a pixmap with queued work makes the following
+CPU access wait for the whole stream. Memory bandwidth of the CPU on a WC bo and
+of the engine, and the submit latency, are measured once at init. Prepare hooks
+compare the estimated cost of both paths, returning FALSE leaves the operation
+to the EXA software fallback.
+
+Prepare hooks do not know the extents of the operation, the area is estimated
+from the pixmap sizes, which overestimates it for partial updates of big
+pixmaps, in favor of the GPU.
+*/
+
+#define VIV2D_COST_BENCH_SIZE 256 // pixels, 32bpp
+#define VIV2D_COST_GPU_OP_NS 2000 // stream setup of one operation
+#define VIV2D_COST_BLEND_FACTOR 2 // pixman blend arithmetic over plain copy
+
+// defaults when the benchmark cannot run
+#define VIV2D_COST_CPU_WRITE_PS 1000
+#define VIV2D_COST_CPU_READ_PS 8000
+#define VIV2D_COST_GPU_PS 500
+#define VIV2D_COST_SYNC_NS 100000
+
+static uint64_t Viv2DCostNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Viv2DCostCalibrate(Viv2DPtr v2d)
+{
+	Viv2DCost *cost = &v2d->cost;
+	Viv2DPixmapPrivPtr pix;
+	Viv2DRect rect;
+	char *map, *buf;
+	int bytes;
+	uint64_t t0, t_write, t_read, t_small, t_big;
+
+	cost->cpu_write_ps = VIV2D_COST_CPU_WRITE_PS;
+	cost->cpu_read_ps = VIV2D_COST_CPU_READ_PS;
+	cost->gpu_ps = VIV2D_COST_GPU_PS;
+	cost->sync_ns = VIV2D_COST_SYNC_NS;
+	cost->queued_ns = 0;
+	cost->queued_ts = etna_cmd_stream_timestamp(v2d->stream);
+
+	pix = _Viv2DOpCreateTmpPix(v2d, VIV2D_COST_BENCH_SIZE, VIV2D_COST_BENCH_SIZE, 32);
+	if (!pix->bo) {
+		free(pix);
+		return;
+	}
+	_Viv2DSetFormat(32, 32, &pix->format);
+	bytes = pix->pitch * pix->height;
+
+	map = etna_bo_map(pix->bo);
+	buf = malloc(bytes);
+	if (!map || !buf)
+		goto out;
+
+	// CPU, first pass faults the pages in
+	etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_WRITE);
+	memset(map, 0, bytes);
+	t0 = Viv2DCostNow();
+	memset(map, 0xff, bytes);
+	t_write = Viv2DCostNow() - t0;
+	t0 = Viv2DCostNow();
+	memcpy(buf, map, bytes);
+	t_read = Viv2DCostNow() - t0;
+	etna_bo_cpu_fini(pix->bo);
+
+	// GPU, a 1x1 fill is mostly submit and wait latency
+	rect.x1 = 0;
+	rect.y1 = 0;
+	rect.x2 = 1;
+	rect.y2 = 1;
+	t0 = Viv2DCostNow();
+	_Viv2DStreamSolid(v2d, pix, 0, &rect, 1);
+	_Viv2DStreamCommit(v2d, FALSE);
+	t_small = Viv2DCostNow() - t0;
+
+	rect.x2 = pix->width;
+	rect.y2 = pix->height;
+	t0 = Viv2DCostNow();
+	_Viv2DStreamSolid(v2d, pix, 0, &rect, 1);
+	_Viv2DStreamCommit(v2d, FALSE);
+	t_big = Viv2DCostNow() - t0;
+
+	cost->cpu_write_ps = t_write * 1000 / bytes;
+	cost->cpu_read_ps = t_read * 1000 / bytes;
+	cost->sync_ns = t_small;
+	if (t_big > t_small)
+		cost->gpu_ps = (t_big - t_small) * 1000 / bytes;
+	cost->queued_ts = etna_cmd_stream_timestamp(v2d->stream);
+
+out:
+	free(buf);
+	_Viv2DOpDelTmpPix(v2d, pix);
+
+	VIV2D_INFO_MSG("cost model cpu write:%dps/B read:%dps/B gpu:%dps/B sync:%dns",
+	               cost->cpu_write_ps, cost->cpu_read_ps, cost->gpu_ps, cost->sync_ns);
+}
+
+static inline Bool Viv2DCostBusy(Viv2DPixmapPrivPtr pix)
+{
+	return pix && pix->refcnt > 0;
+}
+
+// engine time queued since the last submit
+static inline uint64_t Viv2DCostQueued(Viv2DCost *cost, Viv2DPtr v2d)
+{
+	uint32_t ts = etna_cmd_stream_timestamp(v2d->stream);
+	if (ts != cost->queued_ts) {
+		cost->queued_ts = ts;
+		cost->queued_ns = 0;
+	}
+	return cost->queued_ns;
+}
+
+Bool Viv2DCostUseGPU(Viv2DPtr v2d, enum viv2d_cost_op kind, Viv2DPixmapPrivPtr dst, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr msk)
+{
+	Viv2DCost *cost = &v2d->cost;
+	uint64_t area, bytes, cpu, gpu, queued;
+	int reads, passes;
+
+	area = (uint64_t)dst->width * dst->height;
+	// composite sources may be repeated
+	if (kind == viv2d_cost_copy && (uint64_t)src->width * src->height < area)
+		area = (uint64_t)src->width * src->height;
+	bytes = area * (dst->format.bpp ? dst->format.bpp : 32) / 8;
+
+	switch (kind) {
+	case viv2d_cost_solid:
+		reads = 0;
+		passes = 1;
+		break;
+	case viv2d_cost_copy:
+		reads = 1;
+		passes = 1;
+		break;
+	default:
+		// src and dst, mask goes through a temporary on the GPU
+		reads = msk ? 3 : 2;
+		passes = msk ? 3 : 1;
+		break;
+	}
+
+	cpu = bytes * (cost->cpu_write_ps + reads * cost->cpu_read_ps) / 1000;
+	if (kind == viv2d_cost_composite)
+		cpu *= VIV2D_COST_BLEND_FACTOR;
+	gpu = VIV2D_COST_GPU_OP_NS + bytes * passes * cost->gpu_ps / 1000;
+
+	queued = Viv2DCostQueued(cost, v2d);
+
+	// software fallback has to wait for the queued work on its operands
+	if (Viv2DCostBusy(dst) || Viv2DCostBusy(src) || Viv2DCostBusy(msk))
+		cpu += cost->sync_ns + queued;
+
+	if (gpu > cpu) {
+		VIV2D_DBG_MSG("Viv2DCostUseGPU kind:%d %dx%d cpu:%lluns gpu:%lluns, use CPU", kind, dst->width, dst->height,
+		              (unsigned long long)cpu, (unsigned long long)gpu);
+		return FALSE;
+	}
+
+	cost->queued_ns = queued + gpu;
+	return TRUE;
+}
+
+#endif
@@ -0,0 +1,342 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dixstruct.h"
+#include "windowstr.h"
+#include <X11/Xproto.h>
+#include <X11/extensions/shmproto.h>
+#include <xf86drm.h>
+#include "extnsionst.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+#include "viv2d_op.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_DEFER_ACCESS
+#if HAVE_NOTIFY_FD
+
+/*
+GetImage and ShmGetImage on a pixmap the engine still has queued work for commits the stream
+and waits for the pipe in PrepareAccess, blocking every client. Instead, the
+stream is submitted with an out fence and the request is put back: the client
+is ignored until the fence fd becomes readable in the server main loop, then
+the request runs again with the engine done. A woken request is never
+deferred twice, it waits as before if the pixmap got busy again meanwhile.
+Byte swapped clients are left alone, their request is already swapped in
+place and could not be parsed again. Out fences need etnaviv 1.1, older
+kernels keep the blocking path. The MIT-SHM dispatch entry only exists once
+the extensions are initialised, after the screens: it is wrapped from
+CreateScreenResources.
+*/
+
+typedef struct _Viv2DDeferWait {
+	struct _Viv2DDeferWait *next;
+	ClientPtr client;
+	int fd; // sync_file of the submit the request waits for
+	Bool woken;
+} Viv2DDeferWait;
+
+typedef struct _Viv2DDefer {
+	ScreenPtr pScreen;
+	Viv2DDeferWait *waits;
+	CreateScreenResourcesProcPtr CreateScreenResources;
+} Viv2DDefer;
+
+// request vector is global, one screen defers
+static Viv2DDefer *viv2d_defer;
+static int (*Viv2DDeferProcGetImage)(ClientPtr client);
+static int (*Viv2DDeferProcShm)(ClientPtr client);
+static int viv2d_defer_shm_base;
+
+static void Viv2DDeferRemove(Viv2DDefer *defer, Viv2DDeferWait *wait) {
+	Viv2DDeferWait **p;
+
+	for (p = &defer->waits; *p; p = &(*p)->next) {
+		if (*p == wait) {
+			*p = wait->next;
+			break;
+		}
+	}
+
+	if (wait->fd >= 0) {
+		RemoveNotifyFd(wait->fd);
+		close(wait->fd);
+	}
+	free(wait);
+}
+
+static void Viv2DDeferNotify(int fd, int ready, void *data) {
+	Viv2DDeferWait *wait = data;
+
+	RemoveNotifyFd(wait->fd);
+	close(wait->fd);
+	wait->fd = -1;
+	wait->woken = TRUE;
+	AttendClient(wait->client);
+}
+
+static Viv2DDeferWait *Viv2DDeferFind(Viv2DDefer *defer, ClientPtr client) {
+	Viv2DDeferWait *wait;
+
+	for (wait = defer->waits; wait; wait = wait->next) {
+		if (wait->client == client)
+			return wait;
+	}
+	return NULL;
+}
+
+/* the pixmap behind drawable id, if the engine has work for it queued or running */
+static Viv2DPixmapPrivPtr Viv2DDeferBusyPix(Viv2DDefer *defer, ClientPtr client, XID id) {
+	DrawablePtr pDraw;
+	PixmapPtr pPixmap;
+	Viv2DPixmapPrivPtr pix;
+
+	if (dixLookupDrawable(&pDraw, id, client, 0, DixGetAttrAccess) != Success)
+		return NULL;
+	if (pDraw->pScreen != defer->pScreen)
+		return NULL;
+
+	if (pDraw->type == DRAWABLE_WINDOW)
+		pPixmap = pDraw->pScreen->GetWindowPixmap((WindowPtr)pDraw);
+	else
+		pPixmap = (PixmapPtr)pDraw;
+
+	pix = Viv2DPixmapPrivFromPixmap(pPixmap);
+	if (!pix || !pix->bo || pix->refcnt <= 0)
+		return NULL;
+
+	// ready only means out of the stream, the submit may still be running
+	if (!etna_bo_ready(pix->bo))
+		return pix;
+	if (etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_READ | DRM_ETNA_PREP_NOSYNC))
+		return pix;
+
+	etna_bo_cpu_fini(pix->bo);
+	return NULL;
+}
+
+/*
+ * TRUE if the current request of client has been put back, to run again
+ * once the engine is done with the drawable.
+ */
+static Bool Viv2DDeferRequest(ClientPtr client, XID id) {
+	Viv2DDefer *defer = viv2d_defer;
+	Viv2DDeferWait *wait;
+	Viv2DPtr v2d;
+	int fd;
+
+	if (!defer || client->swapped)
+		return FALSE;
+
+	wait = Viv2DDeferFind(defer, client);
+	if (wait) {
+		Viv2DDeferRemove(defer, wait);
+		return FALSE;
+	}
+
+	if (!Viv2DDeferBusyPix(defer, client, id))
+		return FALSE;
+
+	v2d = Viv2DPrivFromScreen(defer->pScreen);
+	// a failed submit leaves the zeroed fence_fd of the request
+	fd = _Viv2DStreamCommitFence(v2d);
+	if (fd <= 0)
+		return FALSE;
+
+	wait = calloc(1, sizeof(*wait));
+	if (!wait) {
+		close(fd);
+		return FALSE;
+	}
+
+	wait->client = client;
+	wait->fd = fd;
+	if (!SetNotifyFd(fd, Viv2DDeferNotify, X_NOTIFY_READ, wait)) {
+		close(fd);
+		free(wait);
+		return FALSE;
+	}
+
+	wait->next = defer->waits;
+	defer->waits = wait;
+
+	VIV2D_DBG_MSG("Viv2DDeferRequest client:%d fd:%d", client->index, fd);
+
+	ResetCurrentRequest(client);
+	client->sequence--;
+	IgnoreClient(client);
+	return TRUE;
+}
+
+static int Viv2DDeferGetImage(ClientPtr client) {
+	REQUEST(xGetImageReq);
+
+	if (client->req_len == bytes_to_int32(sizeof(xGetImageReq)) &&
+	        Viv2DDeferRequest(client, stuff->drawable))
+		return Success;
+
+	return Viv2DDeferProcGetImage(client);
+}
+
+static int Viv2DDeferShm(ClientPtr client) {
+	REQUEST(xShmGetImageReq);
+
+	if (stuff->shmReqType == X_ShmGetImage &&
+	        client->req_len == bytes_to_int32(sizeof(xShmGetImageReq)) &&
+	        Viv2DDeferRequest(client, stuff->drawable))
+		return Success;
+
+	return Viv2DDeferProcShm(client);
+}
+
+static Bool Viv2DDeferCreateScreenResources(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DDefer *defer = v2d->defer;
+	ExtensionEntry *ext;
+	Bool ret;
+
+	pScreen->CreateScreenResources = defer->CreateScreenResources;
+	ret = pScreen->CreateScreenResources(pScreen);
+	defer->CreateScreenResources = pScreen->CreateScreenResources;
+	pScreen->CreateScreenResources = Viv2DDeferCreateScreenResources;
+
+	ext = CheckExtension(SHMNAME);
+	if (ret && ext && !Viv2DDeferProcShm) {
+		viv2d_defer_shm_base = ext->base;
+		Viv2DDeferProcShm = ProcVector[ext->base];
+		ProcVector[ext->base] = Viv2DDeferShm;
+	}
+
+	return ret;
+}
+
+static void Viv2DDeferClientState(CallbackListPtr *list, pointer user_data, pointer call_data) {
+	Viv2DDefer *defer = user_data;
+	NewClientInfoRec *info = call_data;
+	Viv2DDeferWait *wait;
+
+	if (info->client->clientState != ClientStateGone &&
+	        info->client->clientState != ClientStateRetained)
+		return;
+
+	while ((wait = Viv2DDeferFind(defer, info->client)))
+		Viv2DDeferRemove(defer, wait);
+}
+
+Bool Viv2DDeferScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	drmVersionPtr version;
+	Bool fence_out;
+
+	if (viv2d_defer)
+		return TRUE;
+
+	version = drmGetVersion(v2d->fd);
+	if (!version)
+		return TRUE;
+	fence_out = version->version_major > 1 ||
+	            (version->version_major == 1 && version->version_minor >= 1);
+	drmFreeVersion(version);
+	if (!fence_out) {
+		VIV2D_INFO_MSG("etnaviv has no out fences, GetImage is not deferred");
+		return TRUE;
+	}
+
+	v2d->defer = calloc(1, sizeof(*v2d->defer));
+	if (!v2d->defer)
+		return FALSE;
+
+	v2d->defer->pScreen = pScreen;
+	if (!AddCallback(&ClientStateCallback, Viv2DDeferClientState, v2d->defer)) {
+		free(v2d->defer);
+		v2d->defer = NULL;
+		return FALSE;
+	}
+
+	viv2d_defer = v2d->defer;
+	Viv2DDeferProcGetImage = ProcVector[X_GetImage];
+	ProcVector[X_GetImage] = Viv2DDeferGetImage;
+
+	v2d->defer->CreateScreenResources = pScreen->CreateScreenResources;
+	pScreen->CreateScreenResources = Viv2DDeferCreateScreenResources;
+	return TRUE;
+}
+
+void Viv2DDeferScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DDefer *defer = v2d->defer;
+
+	if (!defer)
+		return;
+
+	if (ProcVector[X_GetImage] == Viv2DDeferGetImage)
+		ProcVector[X_GetImage] = Viv2DDeferProcGetImage;
+	if (Viv2DDeferProcShm && ProcVector[viv2d_defer_shm_base] == Viv2DDeferShm)
+		ProcVector[viv2d_defer_shm_base] = Viv2DDeferProcShm;
+	Viv2DDeferProcShm = NULL;
+	if (pScreen->CreateScreenResources == Viv2DDeferCreateScreenResources)
+		pScreen->CreateScreenResources = defer->CreateScreenResources;
+
+	while (defer->waits) {
+		Viv2DDeferWait *wait = defer->waits;
+		if (!wait->woken)
+			AttendClient(wait->client);
+		Viv2DDeferRemove(defer, wait);
+	}
+
+	DeleteCallback(&ClientStateCallback, Viv2DDeferClientState, defer);
+	viv2d_defer = NULL;
+	free(defer);
+	v2d->defer = NULL;
+}
+#else
+Bool Viv2DDeferScreenInit(ScreenPtr pScreen) {
+	return TRUE;
+}
+
+void Viv2DDeferScreenFini(ScreenPtr pScreen) {
+}
+#endif
+#endif
@@ -30,6 +30,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -98,6 +99,64 @@ static Viv2DBlendOp viv2d_blend_op[] = {
 
 #define BLEND_SIZE PictOpAdd
 
+#ifdef VIV2D_SUPPORT_A8_DST
+/*
+A8 destinations only keep the alpha channel, the blender writes Aa * Fa + Ab * Fb
+into the single byte. Ops accepted with an A8 destination and the value pixman
+computes for them, whatever the source is (a8r8g8b8, a8, solid or masked):
+
+	PictOp		A8 dst
+	--------------------------------------------------
+	Clear		0
+	Src			Aa
+	Over		Aa + Ab * (1 - Aa)
+	Add			min(1, Aa + Ab)
+
+other ops are sent to software.
+*/
+static inline Bool Viv2DA8DstOp(int op) {
+	switch (op) {
+	case PictOpClear:
+	case PictOpSrc:
+	case PictOpOver:
+	case PictOpAdd:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+#endif
+
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+/*
+With a component alpha mask, pixman computes src IN mask per component, then
+blends it with the op, except that the alpha used as destination factor is
+src.a * mask per component. Blending the src IN mask tmp is right as long as
+the op does not use the source alpha as destination factor. Over is done
+natively in two passes:
+
+	dst = dst * (1 - src.a * mask)		(OutReverse with mask)
+	dst = dst + src * mask				(Add with src IN mask)
+
+other ops are sent to software.
+*/
+static inline Bool Viv2DComponentAlphaOp(int op) {
+	switch (op) {
+	case PictOpClear:
+	case PictOpSrc:
+	case PictOpDst:
+	case PictOpOver:
+	case PictOpOverReverse:
+	case PictOpIn:
+	case PictOpOut:
+	case PictOpAdd:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+#endif
+
 #define NO_PICT_FORMAT -1
 /**
  * Picture Formats and their counter parts
@@ -158,11 +217,17 @@ static void Viv2DAllocBuf(struct ARMSOCEXARec *exa, int width, int height, int d
 	if (size > VIV2D_MIN_SIZE && size < VIV2D_MAX_SIZE) { // && _Viv2DSetFormat(depth, bpp, &fmt)) {
 		struct etna_bo *bo;
 		//	VIV2D_INFO_MSG("Viv2DAllocBuf size:%d pitch:%d", pitch * height, pitch);
-		bo = etna_bo_cache_new(v2d->dev, size, ETNA_BO_WC);
+		bo = NULL;
+		if (usage_hint == VIV2D_CREATE_PIXMAP_CACHED)
+			bo = etna_bo_new(v2d->dev, ALIGN(size, 4096), ETNA_BO_CACHED);
+		buf->cached = bo != NULL;
+		if (!bo)
+			bo = etna_bo_cache_new(v2d->dev, size, ETNA_BO_WC);
 		buf->priv = (void *)bo;
 		buf->buf = etna_bo_map(bo);
 	} else {
 		VIV2D_DBG_MSG("Viv2DAllocBuf: use CPU only memory buf:%p size:%d", buf, size);
+		buf->cached = 0;
 		if (size > 0) {
 			buf->priv = NULL;
 			buf->buf = malloc(size);
@@ -174,15 +239,81 @@ static void Viv2DAllocBuf(struct ARMSOCEXARec *exa, int width, int height, int d
 
 	buf->pitch = pitch;
 	buf->size = size;
+	buf->usermem = 0;
+}
+
+/* bo is about to be deleted, the flush callback must not sync it */
+static void Viv2DUsermemForget(Viv2DPtr v2d, struct etna_bo *bo) {
+	Viv2DUsermemSet *set = &v2d->usermem;
+	int i;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->bo[i] == bo) {
+			set->bo[i] = set->bo[--set->count];
+			return;
+		}
+	}
+}
+
+#ifdef VIV2D_FLUSH_CALLBACK
+/* wait for the engine on the client memory it used, then drop its CPU cache lines */
+static void Viv2DUsermemSync(Viv2DPtr v2d) {
+	Viv2DUsermemSet *set = &v2d->usermem;
+	int i;
+
+	_Viv2DStreamCommit(v2d, FALSE);
+
+	for (i = 0; i < set->count; i++) {
+		etna_bo_cpu_prep(set->bo[i], DRM_ETNA_PREP_READ);
+		etna_bo_cpu_fini(set->bo[i]);
+	}
+	set->count = 0;
+}
+#endif
+
+static void Viv2DUnmapUsermemBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf) {
+	if (buf->priv) {
+		Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
+		Viv2DRec *v2d = v2d_exa->v2d;
+		struct etna_bo *bo = (struct etna_bo *)buf->priv;
+
+		Viv2DUsermemForget(v2d, bo);
+
+		// the memory goes back to the client, the engine must be done with it
+		if (!etna_bo_ready(bo))
+			_Viv2DStreamCommit(v2d, TRUE);
+		etna_bo_cpu_prep(bo, DRM_ETNA_PREP_WRITE);
+		etna_bo_cpu_fini(bo);
+
+		VIV2D_DBG_MSG("Viv2DUnmapUsermemBuf bo:%p buf:%p", bo, buf->buf);
+		etna_bo_del(bo);
+	}
+	buf->priv = NULL;
+	buf->buf = NULL;
+	buf->size = 0;
+	buf->pitch = 0;
+	buf->usermem = 0;
 }
 
 static void Viv2DFreeBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf) {
 	VIV2D_DBG_MSG("Viv2DFreeBuf buf:%p size:%d", buf, ALIGN(buf->size, 4096));
+	if (buf->usermem) {
+		Viv2DUnmapUsermemBuf(exa, buf);
+		return;
+	}
+
 	if (buf->priv) {
 		Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
 		Viv2DRec *v2d = v2d_exa->v2d;
 		struct etna_bo *bo = (struct etna_bo *)buf->priv;
-		etna_bo_cache_del(v2d->dev, bo);
+		if (buf->cached) {
+			// not going through the bo cache, the engine must be done with it
+			if (!etna_bo_ready(bo))
+				_Viv2DStreamCommit(v2d, TRUE);
+			etna_bo_del(bo);
+		} else {
+			etna_bo_cache_del(v2d->dev, bo);
+		}
 	} else {
 		VIV2D_DBG_MSG("Viv2DFreeBuf CPU only memory buf:%p size:%d", buf, buf->size);
 		if (buf->buf)
@@ -192,46 +323,40 @@ static void Viv2DFreeBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf) {
 	buf->buf = NULL;
 	buf->pitch = 0;
 	buf->size = 0;
+	buf->cached = 0;
 }
 
+/*
+ * wrap client memory, SHM segments mostly, in an userptr bo the engine reads
+ * and writes in place. Memory the engine cannot address as is stays CPU only
+ * and goes through UploadToScreen. The client owns the memory again once it
+ * gets a reply or an event, the flush callback syncs it before.
+ */
 static Bool Viv2DMapUsermemBuf(struct ARMSOCEXARec *exa, int width, int height, int pitch, void *data, struct ARMSOCEXABuf *buf) {
+	Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
+	Viv2DRec *v2d = v2d_exa->v2d;
 	int size = pitch * height;
+	struct etna_bo *bo;
 
-	if (((uintptr_t)data % 4096) == 0 && (size % 4096) == 0) {
-		Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
-		Viv2DRec *v2d = v2d_exa->v2d;
-
-		struct etna_bo *aligned_bo = etna_bo_from_usermem_prot(v2d->dev, data, size, ETNA_USERPTR_READ | ETNA_USERPTR_WRITE);
-		VIV2D_INFO_MSG("Viv2DMapUsermemBuf bo:%p buf:%p", aligned_bo, data);
+#ifndef VIV2D_FLUSH_CALLBACK
+	return FALSE;
+#endif
+	if (((uintptr_t)data % PAGE_SIZE) || (pitch % VIV2D_PITCH_ALIGN) || size <= VIV2D_USERPTR_MIN_SIZE)
+		return FALSE;
 
-		buf->priv = aligned_bo;
-		buf->buf = data;
-		buf->size = size;
-		buf->pitch = pitch;
-		return TRUE;
-	} else {
+	// the bo is made of whole pages, the engine never goes past size
+	bo = etna_bo_from_usermem_prot(v2d->dev, data, PAGE_ALIGN(size), ETNA_USERPTR_READ | ETNA_USERPTR_WRITE);
+	if (!bo)
 		return FALSE;
-	}
-}
 
-static void Viv2DUnmapUsermemBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf) {
-	if (buf->priv) {
-		int err = 0;
-		Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
-		Viv2DRec *v2d = v2d_exa->v2d;
-		struct etna_bo *bo = (struct etna_bo *)buf->priv;
-//		_Viv2DStreamCommit(v2d, TRUE);
-//		_Viv2DStreamWait(v2d);
-//		err = etna_bo_wait(v2d->dev, v2d->pipe, bo, 5000000000);
-		VIV2D_INFO_MSG("Viv2DUnmapUsermemBuf bo:%p buf:%p err:%d", bo, buf->buf, err);
-//		etna_bo_del(bo);
-		etna_bo_cache_usermem_del(v2d->dev, bo);
+	VIV2D_DBG_MSG("Viv2DMapUsermemBuf bo:%p buf:%p", bo, data);
 
-		buf->priv = NULL;
-		buf->buf = NULL;
-		buf->size = 0;
-		buf->pitch = 0;
-	}
+	buf->priv = bo;
+	buf->buf = data;
+	buf->size = size;
+	buf->pitch = pitch;
+	buf->usermem = 1;
+	return TRUE;
 }
 
 static inline void Viv2DDetachBo(struct ARMSOCRec *pARMSOC, struct ARMSOCPixmapPrivRec *armsocPix) {
@@ -259,6 +384,7 @@ static inline Bool Viv2DAttachBo(struct ARMSOCRec *pARMSOC, struct ARMSOCPixmapP
 		Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 		Viv2DPixmapPrivPtr pix = armsocPix->priv;
 
+		pix->usermem = FALSE;
 		if (armsocPix->bo) {
 			if (armsocPix->bo == pARMSOC->scanout) {
 				pix->bo = v2d->bo;
@@ -275,6 +401,7 @@ static inline Bool Viv2DAttachBo(struct ARMSOCRec *pARMSOC, struct ARMSOCPixmapP
 		} else {
 			if (armsocPix->buf.priv) {
 				pix->bo = (struct etna_bo *)armsocPix->buf.priv;
+				pix->usermem = armsocPix->buf.usermem;
 				VIV2D_DBG_MSG("Viv2DAttachBo attach from armsoc buf pix:%p bo:%p buf:%p size:%d", pix, pix->bo, armsocPix->buf.buf, armsocPix->buf.size);
 			} else {
 				VIV2D_DBG_MSG("Viv2DAttachBo CPU only memory pix:%p buf:%p size:%d", pix, &armsocPix->buf, armsocPix->buf.size);
@@ -299,65 +426,59 @@ static void Viv2DReattach(PixmapPtr pPixmap, int width, int height, int pitch) {
 	pix->width = width;
 	pix->height = height;
 	pix->pitch = pitch;
+	pix->has_color = FALSE;
 
 	Viv2DDetachBo(pARMSOC, armsocPix);
 	Viv2DAttachBo(pARMSOC, armsocPix);
 }
 
-static inline uint32_t Viv2DScale16(uint32_t val, int bits)
-{
-	val <<= (16 - bits);
-	while (bits < 16) {
-		val |= val >> bits;
-		bits <<= 1;
-	}
-	return val >> 8;
-}
-
-static inline uint32_t Viv2DColour(Pixel pixel, int depth) {
-	uint32_t colour;
-	switch (depth) {
-	case 15: /* A1R5G5B5 */
-		colour = (pixel & 0x8000 ? 0xff000000 : 0) |
-		         Viv2DScale16((pixel & 0x7c00) >> 10, 5) << 16 |
-		         Viv2DScale16((pixel & 0x03e0) >> 5, 5) << 8 |
-		         Viv2DScale16((pixel & 0x001f), 5);
-		break;
-	case 16: /* R5G6B5 */
-		colour = 0xff000000 |
-		         Viv2DScale16((pixel & 0xf800) >> 11, 5) << 16 |
-		         Viv2DScale16((pixel & 0x07e0) >> 5, 6) << 8 |
-		         Viv2DScale16((pixel & 0x001f), 5);
-		break;
-	case 24: /* A8R8G8B8 */
-		colour = 0xff000000 | pixel;
-		break;
-	default:
-		colour = pixel;
-		break;
-	}
-	return colour;
-}
-
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
-static CARD32 Viv2DGetFirstPixel(DrawablePtr pDraw)
+/*
+ * Get the first pixel without waiting for the GPU: use the color of the last
+ * solid fill covering the pixmap, else read it only if the bo is idle.
+ * Return FALSE if the GPU has still to render it.
+ */
+static Bool Viv2DGetFirstPixel(DrawablePtr pDraw, CARD32 *color)
 {
+	PixmapPtr pPixmap = (PixmapPtr)pDraw;
+	Viv2DPixmapPrivPtr pix = Viv2DPixmapPrivFromPixmap(pPixmap);
 	union { CARD32 c32; CARD16 c16; CARD8 c8; char c; } pixel;
 
+	if (pix->has_color) {
+		*color = pix->color;
+		return TRUE;
+	}
+
+	if (pix->bo && pix->refcnt > 0) {
+		if (!etna_bo_ready(pix->bo))
+			return FALSE;
+		if (etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_READ | DRM_ETNA_PREP_NOSYNC))
+			return FALSE;
+		etna_bo_cpu_fini(pix->bo);
+	}
+
 	pDraw->pScreen->GetImage(pDraw, 0, 0, 1, 1, ZPixmap, ~0, &pixel.c);
 
 	switch (pDraw->bitsPerPixel) {
 	case 32:
-		return pixel.c32;
+		*color = pixel.c32;
+		break;
 	case 16:
-		return pixel.c16;
+		*color = pixel.c16;
+		break;
 	case 8:
 	case 4:
 	case 1:
-		return pixel.c8;
+		*color = pixel.c8;
+		break;
 	default:
 		assert(0);
 	}
+
+	// valid until the next write
+	pix->color = *color;
+	pix->has_color = TRUE;
+	return TRUE;
 }
 #endif
 
@@ -416,8 +537,14 @@ static void Viv2DFlushCallback(CallbackListPtr *list, pointer user_data,
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
 //	VIV2D_INFO_MSG("Viv2DFlushCallback");
+#ifdef VIV2D_CAPTURE
+	Viv2DCaptureFlush(v2d);
+#endif
 	_Viv2DStreamWait(v2d);
-	_Viv2DStreamCommit(v2d, TRUE);
+	if (v2d->usermem.count)
+		Viv2DUsermemSync(v2d);
+	else
+		_Viv2DStreamCommit(v2d, TRUE);
 
 }
 #endif
@@ -464,7 +591,70 @@ static void Viv2DWaitMarker(ScreenPtr pScreen, int marker)
  * @return FALSE if PrepareAccess() is unsuccessful and EXA should use
  * DownloadFromScreen() to migrate the pixmap out.
  */
-static Bool
+#ifdef VIV2D_CACHED_PIXMAPS
+/*
+ * move a pixmap bo between write combined and cached memory. Called before
+ * CPU access, the CPU copies the contents, it is about to touch them anyway.
+ */
+static void Viv2DMigrateBuf(PixmapPtr pPixmap, Bool cached) {
+	Viv2DRec *v2d = Viv2DPrivFromPixmap(pPixmap);
+	ScrnInfoPtr pScrn = pix2scrn(pPixmap);
+	struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
+	struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+	Viv2DPixmapPrivPtr pix = armsocPix->priv;
+	struct ARMSOCEXABuf buf;
+
+	pARMSOC->pARMSOCEXA->AllocBuf(pARMSOC->pARMSOCEXA, pPixmap->drawable.width, pPixmap->drawable.height,
+	                              pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel,
+	                              cached ? VIV2D_CREATE_PIXMAP_CACHED : 0, &buf);
+	if (!buf.priv || buf.cached != cached || buf.size != armsocPix->buf.size) {
+		pARMSOC->pARMSOCEXA->FreeBuf(pARMSOC->pARMSOCEXA, &buf);
+		return;
+	}
+
+	VIV2D_DBG_MSG("Viv2DMigrateBuf pix:%p bo:%p -> %p cached:%d", pix, pix->bo, buf.priv, cached);
+
+	if (!etna_bo_ready(pix->bo)) {
+		_Viv2DStreamCommit(v2d, TRUE);
+		_Viv2DStreamWait(v2d);
+	}
+
+	etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_READ);
+	etna_bo_cpu_prep(buf.priv, DRM_ETNA_PREP_WRITE);
+	memcpy(buf.buf, armsocPix->buf.buf, buf.size);
+	etna_bo_cpu_fini(buf.priv);
+	etna_bo_cpu_fini(pix->bo);
+
+	pARMSOC->pARMSOCEXA->FreeBuf(pARMSOC->pARMSOCEXA, &armsocPix->buf);
+	armsocPix->buf = buf;
+	pix->bo = (struct etna_bo *)buf.priv;
+	pix->refcnt = 0;
+	pPixmap->devPrivate.ptr = buf.buf;
+}
+
+/*
+ * placement heuristic : pixmaps the CPU keeps accessing, fb fallbacks read
+ * them back, go to cached bos, and return to write combined ones once the
+ * GPU renders them again. Only driver allocated bos, not dumb or client ones.
+ */
+static inline void Viv2DPlaceBuf(PixmapPtr pPixmap) {
+	struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+	Viv2DPixmapPrivPtr pix = armsocPix->priv;
+
+	// tested before this access counts, MarkDst stops at -VIV2D_CACHED_SCORE
+	if (!armsocPix->bo && !armsocPix->buf.usermem && pix->bo && pix->refcnt >= 0) {
+		if (!armsocPix->buf.cached && pix->cpu_score >= VIV2D_CACHED_SCORE)
+			Viv2DMigrateBuf(pPixmap, TRUE);
+		else if (armsocPix->buf.cached && pix->cpu_score <= -VIV2D_CACHED_SCORE)
+			Viv2DMigrateBuf(pPixmap, FALSE);
+	}
+
+	if (pix->cpu_score < VIV2D_CACHED_SCORE)
+		pix->cpu_score += 2;
+}
+#endif
+
+Bool
 Viv2DPrepareAccess(PixmapPtr pPixmap, int index) {
 	Viv2DRec *v2d = Viv2DPrivFromPixmap(pPixmap);
 	struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
@@ -472,8 +662,17 @@ Viv2DPrepareAccess(PixmapPtr pPixmap, int index) {
 
 //	VIV2D_DBG_MSG("Viv2DPrepareAccess %p (%dx%d) %d (%d)", pPixmap, pix->width, pix->height, index, pix->refcnt);
 
-	// only if pixmap has been used
-	if (pix->refcnt > 0) {
+#ifdef VIV2D_COMPOSITE_BATCH
+	// the CPU may change a source of the open composite
+	_Viv2DOpFlushPending(v2d);
+#endif
+
+#ifdef VIV2D_CACHED_PIXMAPS
+	Viv2DPlaceBuf(pPixmap);
+#endif
+
+	// only if pixmap has been used, cached bos always need cache maintenance
+	if (pix->refcnt > 0 || (pix->refcnt == 0 && armsocPix->buf.cached)) {
 		// flush if remaining state
 		if (pix->bo) {
 			VIV2D_DBG_MSG("Viv2DPrepareAccess pix:%p/%p(%dx%d) bo:%p index:%d refcnt:(%d)", pPixmap, pix, pix->width, pix->height, pix->bo, index, pix->refcnt);
@@ -491,6 +690,9 @@ Viv2DPrepareAccess(PixmapPtr pPixmap, int index) {
 		pix->refcnt = -1;
 	}
 
+	if (index == EXA_PREPARE_DEST || index == EXA_PREPARE_AUX_DEST)
+		pix->has_color = FALSE;
+
 	return ARMSOCPrepareAccess(pPixmap, index);
 }
 
@@ -504,7 +706,7 @@ Viv2DPrepareAccess(PixmapPtr pPixmap, int index) {
  * pixmap set up by PrepareAccess().  Note that the FinishAccess() will not be
  * called if PrepareAccess() failed and the pixmap was migrated out.
  */
-static void
+void
 Viv2DFinishAccess(PixmapPtr pPixmap, int index)
 {
 	struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
@@ -531,8 +733,15 @@ void Viv2DTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
                      PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
                      xTrapezoid * traps)
 {
-	PixmapPtr pSrc = GetDrawablePixmap(pSrcPicture->pDrawable);
-	PixmapPtr pDst = GetDrawablePixmap(pDstPicture->pDrawable);
+	PixmapPtr pSrc, pDst;
+
+#ifdef VIV2D_TRAPEZOID_MASK
+	if (Viv2DTrapezoidsMask(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntrap, traps))
+		return;
+#endif
+
+	pSrc = GetDrawablePixmap(pSrcPicture->pDrawable);
+	pDst = GetDrawablePixmap(pDstPicture->pDrawable);
 
 	if (pSrc)
 		Viv2DPrepareAccess(pSrc, EXA_PREPARE_SRC);
@@ -562,8 +771,15 @@ void Viv2DAddTraps(PicturePtr pPicture, INT16 x_off, INT16 y_off,
 void Viv2DTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
                     PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri, xTriangle *tri)
 {
-	PixmapPtr pSrc = GetDrawablePixmap(pSrcPicture->pDrawable);
-	PixmapPtr pDst = GetDrawablePixmap(pDstPicture->pDrawable);
+	PixmapPtr pSrc, pDst;
+
+#ifdef VIV2D_TRAPEZOID_MASK
+	if (Viv2DTrianglesMask(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntri, tri))
+		return;
+#endif
+
+	pSrc = GetDrawablePixmap(pSrcPicture->pDrawable);
+	pDst = GetDrawablePixmap(pDstPicture->pDrawable);
 
 	if (pSrc)
 		Viv2DPrepareAccess(pSrc, EXA_PREPARE_SRC);
@@ -649,6 +865,11 @@ Viv2DDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 	Viv2DPixmapPrivPtr pix = armsocPix->priv;
 	VIV2D_DBG_MSG("Viv2DDestroyPixmap pix %p", pix);
 
+#ifdef VIV2D_COMPOSITE_BATCH
+	// the open composite may use it, and a new pixmap may get its priv address
+	_Viv2DOpFlushPending(Viv2DPrivFromARMSOC(pARMSOC));
+#endif
+
 	Viv2DDetachBo(pARMSOC, armsocPix);
 
 	free(pix);
@@ -699,7 +920,8 @@ Viv2DModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
 			} else {
 				if (pix->width != width ||
 				        pix->height != height ||
-				        pix->pitch != armsocPix->buf.pitch
+				        pix->pitch != armsocPix->buf.pitch ||
+				        pix->bo != armsocPix->buf.priv
 				   ) {
 					VIV2D_DBG_MSG("Viv2DModifyPixmapHeader native pixmap:%p armsocPix:%p pix:%p", pPixmap, armsocPix, pix);
 					pix->width = width;
@@ -754,26 +976,127 @@ Viv2DModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
  */
 
 #ifdef VIV2D_UPLOAD_TO_SCREEN
+static Bool Viv2DUploadInit(Viv2DPtr v2d) {
+	int i;
+
+	for (i = 0; i < VIV2D_UPLOAD_SLOTS; i++) {
+		v2d->upload.bo[i] = etna_bo_new(v2d->dev, VIV2D_UPLOAD_SLOT_SIZE, ETNA_BO_WC);
+		if (!v2d->upload.bo[i])
+			return FALSE;
+	}
+	v2d->upload.next = 0;
+	return TRUE;
+}
+
+static void Viv2DUploadFini(Viv2DPtr v2d) {
+	int i;
+
+	for (i = 0; i < VIV2D_UPLOAD_SLOTS; i++) {
+		if (v2d->upload.bo[i])
+			etna_bo_del(v2d->upload.bo[i]);
+		v2d->upload.bo[i] = NULL;
+	}
+}
+
+/*
+ * next staging slot, ready for CPU writes. Slots are taken in turn, the CPU
+ * only waits when it comes back to a slot whose blit has not retired yet,
+ * and then only on that bo fence.
+ */
+static struct etna_bo *Viv2DUploadSlot(Viv2DPtr v2d) {
+	struct etna_bo *bo = v2d->upload.bo[v2d->upload.next];
+
+	v2d->upload.next = (v2d->upload.next + 1) % VIV2D_UPLOAD_SLOTS;
+
+	if (!etna_bo_ready(bo))
+		_Viv2DStreamCommit(v2d, TRUE);
+
+	etna_bo_cpu_prep(bo, DRM_ETNA_PREP_WRITE);
+	return bo;
+}
+
+static inline void Viv2DUploadRows(char *dst, int dst_pitch, const char *src, int src_pitch, int row_size, int rows) {
+	if (dst_pitch == src_pitch) {
+		memcpy(dst, src, dst_pitch * (rows - 1) + row_size);
+		return;
+	}
+
+	while (rows--) {
+		memcpy(dst, src, row_size);
+		dst += dst_pitch;
+		src += src_pitch;
+	}
+}
+
+static void Viv2DUploadBlit(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, int src_x, int src_y,
+                            Viv2DPixmapPrivPtr dst, int x, int y, int w, int h) {
+	Viv2DRect rects[1];
+
+	rects[0].x1 = x;
+	rects[0].y1 = y;
+	rects[0].x2 = x + w;
+	rects[0].y2 = y + h;
+
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+	_Viv2DStreamSrc(v2d, src);
+	_Viv2DStreamSrcOrigin(v2d, src_x, src_y, w, h);
+	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOp(v2d, NULL, 0, 0, FALSE, FALSE);
+	_Viv2DStreamRects(v2d, rects, 1);
+
+	_Viv2DStreamCacheFlush(v2d);
+}
+
+#ifdef VIV2D_USERPTR
+/* blit straight from the client memory, mapped as an userptr bo */
+static Bool Viv2DUploadUsermem(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int bpp,
+                               int x, int y, int w, int h, char *src, int src_pitch) {
+	uintptr_t page_start = (uintptr_t)src & PAGE_MASK;
+	int offset = (uintptr_t)src - page_start;
+	int cpp = bpp / 8;
+	size_t size = PAGE_ALIGN(offset + src_pitch * (h - 1) + w * cpp);
+	Viv2DPixmapPrivRec tmp;
+
+	if (size <= VIV2D_USERPTR_MIN_SIZE || (src_pitch % VIV2D_PITCH_ALIGN) || ((offset % src_pitch) % cpp))
+		return FALSE;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.bo = etna_bo_from_usermem_prot(v2d->dev, (void *)page_start, size, ETNA_USERPTR_READ);
+	if (!tmp.bo) {
+		VIV2D_DBG_MSG("Viv2DUploadToScreen cannot create usermem");
+		return FALSE;
+	}
+	tmp.width = w;
+	tmp.height = h;
+	tmp.pitch = src_pitch;
+	tmp.format = dst->format;
+
+	_Viv2DOpMarkDst(dst);
+	Viv2DUploadBlit(v2d, &tmp, (offset % src_pitch) / cpp, offset / src_pitch, dst, x, y, w, h);
+
+	// the request buffer is reused as soon as we return
+	_Viv2DStreamCommit(v2d, TRUE);
+	// the engine only reads it, a write prep waits for the readers
+	etna_bo_cpu_prep(tmp.bo, DRM_ETNA_PREP_WRITE);
+	etna_bo_cpu_fini(tmp.bo);
+	etna_bo_del(tmp.bo);
+	return TRUE;
+}
+#endif
+
 static Bool Viv2DUploadToScreen(PixmapPtr pDst,
                                 int x, int y, int w, int h, char *src, int src_pitch) {
 	ScrnInfoPtr pScrn = pix2scrn(pDst);
 	struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 	Viv2DPixmapPrivPtr dst = Viv2DPixmapPrivFromPixmap(pDst);
-	Viv2DRect rects[1];
-	int height = h;
-	Viv2DPixmapPrivPtr tmp;
-	int pitch;
-	char *src_buf, *buf;
-	Viv2DFormat tmp_fmt;
-	int use_usermem = 0;
-	int src_x = 0;
-	int src_y = 0;
+	Viv2DPixmapPrivRec slot;
+	int row_size, pitch, band;
 
 	if (w * h < 4)
 		return FALSE;
 
-	if (!dst->bo)
+	if (!dst->bo || _Viv2DPixIsLarge(dst))
 		return FALSE;
 #ifdef VIV2D_PREPARE_SET_FORMAT
 	if (!_Viv2DSetFormat(pDst->drawable.depth, pDst->drawable.bitsPerPixel, &dst->format)) {
@@ -787,114 +1110,115 @@ static Bool Viv2DUploadToScreen(PixmapPtr pDst,
 //		VIV2D_UNSUPPORTED_MSG("Viv2DUploadToScreen unsupported dst A8 dst:%p/%p", pDst, dst);
 		return FALSE;
 	}
+#else
+	if (dst->format.fmt == DE_FORMAT_A8 && !v2d->caps.a8_dst)
+		return FALSE;
 #endif
 
-	tmp_fmt = dst->format;
+#ifdef VIV2D_SUPPORT_MONO
+	if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+		return FALSE;
+#endif
 
 #ifdef VIV2D_USERPTR
-
-	uintptr_t page_start = ((uintptr_t)src / (PAGE_SIZE * src_pitch)) * (PAGE_SIZE * src_pitch);
-	char *start_buf = (char *)page_start;
-
-	src_x = (((uintptr_t)src - page_start) % src_pitch) / 4;
-	src_y = (((uintptr_t)src - page_start) / src_pitch);
-	size_t aligned_size = PAGE_ALIGN(src_pitch * (h + src_y + 1));
-
-	VIV2D_INFO_MSG("Viv2DUploadToScreen page aligned %p/%p %dx%d %x", start_buf, src, src_x, src_y, aligned_size);
-
-//	src_x = 0;
-//	src_y = 0;
-	if (aligned_size < 1024 * 1024 * 16) {
-
-		VIV2D_INFO_MSG("Viv2DUploadToScreen page aligned %p %dx%d", src, src_x, src_y);
-		struct etna_bo *aligned_bo = etna_bo_from_usermem_prot(v2d->dev, start_buf, aligned_size, ETNA_USERPTR_READ);
-		if (aligned_bo) {
-			tmp = calloc(sizeof (*tmp), 1);
-			VIV2D_INFO_MSG("Viv2DUploadToScreen create usermem %p/%p %d %dx%d:%dx%d %x", start_buf, src, src_pitch, src_x, src_y, w, h, aligned_size);
-			tmp->bo = aligned_bo;
-			tmp->width = w;
-			tmp->height = h;
-			tmp->pitch = src_pitch;
-			use_usermem = 1;
-		} else {
-			src_x = 0;
-			src_y = 0;
-			VIV2D_INFO_MSG("Viv2DUploadToScreen cannot create usermem");
-			tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
-		}
-	} else {
-		src_x = 0;
-		src_y = 0;
-		VIV2D_INFO_MSG("Viv2DUploadToScreen cannot create usermem : two large alignement %ld", aligned_size);
-		tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
+	if (Viv2DUploadUsermem(v2d, dst, pDst->drawable.bitsPerPixel, x, y, w, h, src, src_pitch)) {
+		exaMarkSync(pDst->drawable.pScreen);
+		return TRUE;
 	}
-#else
-	tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
 #endif
 
-	tmp->format = tmp_fmt;
+	row_size = w * pDst->drawable.bitsPerPixel / 8;
+	pitch = ALIGN(row_size, VIV2D_PITCH_ALIGN);
+	band = VIV2D_UPLOAD_SLOT_SIZE / pitch;
+	if (!band)
+		return FALSE;
 
-	dst->refcnt++;
+	_Viv2DOpMarkDst(dst);
 
-	if (!use_usermem) {
+	memset(&slot, 0, sizeof(slot));
+	slot.width = w;
+	slot.pitch = pitch;
+	slot.format = dst->format;
 
-		if (pitch == src_pitch)
-			VIV2D_INFO_MSG("SAME PITCH %d", pitch);
+	// rows are copied band by band in the slots, blits are queued, not waited
+	while (h > 0) {
+		int rows = min(h, band);
 
-		pitch = tmp->pitch;
+		slot.bo = Viv2DUploadSlot(v2d);
+		slot.height = rows;
 
-		src_buf = src ;
-		buf = (char *) etna_bo_map(tmp->bo);
+		Viv2DUploadRows(etna_bo_map(slot.bo), pitch, src, src_pitch, row_size, rows);
+		etna_bo_cpu_fini(slot.bo);
 
+		Viv2DUploadBlit(v2d, &slot, 0, 0, dst, x, y, w, rows);
 
-		while (height--) {
-			memcpy(buf, src_buf, pitch);
-			src_buf += src_pitch;
-			buf += pitch;
-		}
+		VIV2D_DBG_MSG("Viv2DUploadToScreen queued dst:%p/%p slot:%p src:%p(%d/%d) %dx%d(%dx%d)",
+		              pDst, dst, slot.bo, src, src_pitch, pitch, x, y, w, rows);
 
+		src += rows * src_pitch;
+		y += rows;
+		h -= rows;
 	}
 
-	rects[0].x1 = x;
-	rects[0].y1 = y;
-	rects[0].x2 = x + w;
-	rects[0].y2 = y + h;
+	exaMarkSync(pDst->drawable.pScreen);
+
+	return TRUE;
+}
+#endif
+
+#ifdef VIV2D_DOWNLOAD_FROM_SCREEN
+static void Viv2DReadbackFini(Viv2DPtr v2d) {
+	int i;
+
+	for (i = 0; i < VIV2D_READBACK_SLOTS; i++) {
+		if (v2d->readback.bo[i])
+			etna_bo_del(v2d->readback.bo[i]);
+		v2d->readback.bo[i] = NULL;
+	}
+}
+
+/*
+ * readback slots are cached bos, allocated on first use : the engine writes
+ * them, the CPU reads them through the cache after cpu_prep invalidated it.
+ */
+static struct etna_bo *Viv2DReadbackSlot(Viv2DPtr v2d, int i) {
+	if (!v2d->readback.bo[i])
+		v2d->readback.bo[i] = etna_bo_new(v2d->dev, VIV2D_READBACK_SLOT_SIZE, ETNA_BO_CACHED);
+	return v2d->readback.bo[i];
+}
+
+static void Viv2DReadbackBlit(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, int x, int y,
+                              Viv2DPixmapPrivPtr slot, int w, int h) {
+	Viv2DRect rects[1];
+
+	rects[0].x1 = 0;
+	rects[0].y1 = 0;
+	rects[0].x2 = w;
+	rects[0].y2 = h;
 
 	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
-	_Viv2DStreamSrc(v2d, tmp); // tmp source
-	_Viv2DStreamSrcOrigin(v2d, src_x, src_y, tmp->width, tmp->height); // tmp source
-	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamSrc(v2d, src);
+	_Viv2DStreamSrcOrigin(v2d, x, y, w, h);
+	_Viv2DStreamDst(v2d, slot, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
 	_Viv2DStreamBlendOp(v2d, NULL, 0, 0, FALSE, FALSE);
 	_Viv2DStreamRects(v2d, rects, 1);
 
 	_Viv2DStreamCacheFlush(v2d);
+}
 
-	VIV2D_INFO_MSG("Viv2DUploadToScreen blit done dst:%p/%p bo:%p buf:%p src_buf:%p(%d/%d) %dx%d(%dx%d) %dx%d %d/%d",
-	               pDst, dst, dst->bo, etna_bo_map(dst->bo),
-	               src, src_pitch, tmp->pitch, x, y, w, h,
-	               pDst->drawable.width, pDst->drawable.height,
-	               pDst->drawable.depth, pDst->drawable.bitsPerPixel);
-
-#ifdef VIV2D_USERPTR
-	if (use_usermem) {
-		_Viv2DStreamCommit(v2d, TRUE);
-		etna_bo_wait(v2d->dev, v2d->pipe, tmp->bo, 5000000000);
-		etna_bo_del(tmp->bo);
-		free(tmp);
-	} else {
-		_Viv2DOpDelTmpPix(v2d, tmp);
+static inline void Viv2DReadbackRows(char *dst, int dst_pitch, const char *src, int src_pitch, int row_size, int rows) {
+	if (dst_pitch == src_pitch) {
+		memcpy(dst, src, src_pitch * (rows - 1) + row_size);
+		return;
 	}
-#else
-	_Viv2DOpDelTmpPix(v2d, tmp);
-#endif
-
-	exaMarkSync(pDst->drawable.pScreen);
 
-	return TRUE;
+	while (rows--) {
+		memcpy(dst, src, row_size);
+		dst += dst_pitch;
+		src += src_pitch;
+	}
 }
-#endif
 
-#ifdef VIV2D_DOWNLOAD_FROM_SCREEN
 /**
  * DownloadFromScreen() loads a rectangle of data from pSrc into dst
  *
@@ -929,69 +1253,78 @@ static Bool Viv2DUploadToScreen(PixmapPtr pDst,
 static Bool Viv2DDownloadFromScreen(PixmapPtr pSrc,
                                     int x, int y,
                                     int w, int h, char *dst, int dst_pitch) {
-
-	int i, pitch;
 	ScrnInfoPtr pScrn = pix2scrn(pSrc);
 	struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 	Viv2DPixmapPrivPtr src = Viv2DPixmapPrivFromPixmap(pSrc);
-	Viv2DRect rects[1];
-	Viv2DPixmapPrivPtr tmp;
-	char *dst_buf, *src_buf, *buf;
-	Viv2DFormat tmp_fmt;
+	Viv2DPixmapPrivRec slot[VIV2D_READBACK_SLOTS];
+	int row_size, pitch, band, bands;
+	int i, queued;
 
 	if (w * h < 4)
 		return FALSE;
 
-	if (!src->bo)
+	if (!src->bo || _Viv2DPixIsLarge(src))
 		return FALSE;
 #ifdef VIV2D_PREPARE_SET_FORMAT
 	if (!_Viv2DSetFormat(pSrc->drawable.depth, pSrc->drawable.bitsPerPixel, &src->format)) {
-		VIV2D_UNSUPPORTED_MSG("Viv2DUploadToScreen unsupported src format %d/%d %p", pSrc->drawable.depth, pSrc->drawable.bitsPerPixel, src);
+		VIV2D_UNSUPPORTED_MSG("Viv2DDownloadFromScreen unsupported src format %d/%d %p", pSrc->drawable.depth, pSrc->drawable.bitsPerPixel, src);
 		return FALSE;
 	}
 #endif
+#ifdef VIV2D_SUPPORT_MONO
+	if (src->format.fmt == DE_FORMAT_MONOCHROME)
+		return FALSE;
+#endif
+#ifdef VIV2D_SUPPORT_A8_DST
+	if (src->format.fmt == DE_FORMAT_A8 && !v2d->caps.a8_dst)
+		return FALSE;
+#else
+	if (src->format.fmt == DE_FORMAT_A8)
+		return FALSE;
+#endif
 
-	tmp_fmt = src->format;
-	tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pSrc->drawable.bitsPerPixel);
-	tmp->format = tmp_fmt;
-
-	pitch = tmp->pitch;
-
-	rects[0].x1 = x;
-	rects[0].y1 = y;
-	rects[0].x2 = x + w;
-	rects[0].y2 = y + h;
+	row_size = w * pSrc->drawable.bitsPerPixel / 8;
+	pitch = ALIGN(row_size, VIV2D_PITCH_ALIGN);
+	band = VIV2D_READBACK_SLOT_SIZE / pitch;
+	if (!band)
+		return FALSE;
+	bands = (h + band - 1) / band;
 
-	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1));
-	_Viv2DStreamSrc(v2d, src);
-	_Viv2DStreamSrcOrigin(v2d, 0, 0, tmp->width, tmp->height);
-	_Viv2DStreamDst(v2d, tmp, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
-	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
-	_Viv2DStreamRects(v2d, rects, 1);
+	memset(slot, 0, sizeof(slot));
+	for (i = 0; i < VIV2D_READBACK_SLOTS && i < bands; i++) {
+		slot[i].bo = Viv2DReadbackSlot(v2d, i);
+		if (!slot[i].bo)
+			return FALSE;
+		slot[i].width = w;
+		slot[i].height = band;
+		slot[i].pitch = pitch;
+		slot[i].format = src->format;
+	}
 
+	// every slot gets a band queued before the first wait, then each slot
+	// is refilled as soon as it is read, so the engine runs ahead of the CPU
+	for (queued = 0; queued < VIV2D_READBACK_SLOTS && queued < bands; queued++)
+		Viv2DReadbackBlit(v2d, src, x, y + queued * band, &slot[queued], w, min(band, h - queued * band));
 	_Viv2DStreamCommit(v2d, TRUE);
-	_Viv2DStreamWait(v2d);
 
-	etna_bo_cpu_prep(tmp->bo, DRM_ETNA_PREP_READ);
+	for (i = 0; i < bands; i++) {
+		Viv2DPixmapPrivPtr s = &slot[i % VIV2D_READBACK_SLOTS];
+		int rows = min(band, h - i * band);
 
-	dst_buf = dst;
-	src_buf = (char *) etna_bo_map(tmp->bo);
-	buf = src_buf;
+		etna_bo_cpu_prep(s->bo, DRM_ETNA_PREP_READ);
+		Viv2DReadbackRows(dst + i * band * dst_pitch, dst_pitch, etna_bo_map(s->bo), pitch, row_size, rows);
+		etna_bo_cpu_fini(s->bo);
 
-	for (i = 0; i < h; i++) {
-		memcpy(dst_buf, buf, pitch);
-		dst_buf += dst_pitch;
-		buf += pitch;
+		if (queued < bands) {
+			Viv2DReadbackBlit(v2d, src, x, y + queued * band, s, w, min(band, h - queued * band));
+			_Viv2DStreamCommit(v2d, TRUE);
+			queued++;
+		}
 	}
 
-	etna_bo_cpu_fini(tmp->bo);
-
-	VIV2D_INFO_MSG("Viv2DDownloadFromScreen blit done %p %p %p(%d/%d) %dx%d(%dx%d) %dx%d %d/%d", pSrc, etna_bo_map(src->bo), src, pitch, tmp->pitch, x, y, w, h,
-	               pSrc->drawable.width, pSrc->drawable.height,
-	               pSrc->drawable.depth, pSrc->drawable.bitsPerPixel);
-
-	_Viv2DOpDelTmpPix(v2d, tmp);
+	VIV2D_DBG_MSG("Viv2DDownloadFromScreen done %p %p(%d/%d) %dx%d(%dx%d) %d bands",
+	              pSrc, src, dst_pitch, pitch, x, y, w, h, bands);
 
 	return TRUE;
 }
@@ -1056,19 +1389,42 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap,
 //		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareSolid unsupported dst A8 dst:%p/%p  fg:%x", pPixmap, dst, fg);
 		return FALSE;
 	}
+#else
+	if (dst->format.fmt == DE_FORMAT_A8 && !v2d->caps.a8_dst)
+		return FALSE;
+#endif
+#ifdef VIV2D_SUPPORT_MONO
+	// mono is a source only format
+	if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+		return FALSE;
 #endif
 
-	dst->refcnt++;
+#ifdef VIV2D_COST_MODEL
+	if (!Viv2DCostUseGPU(v2d, viv2d_cost_solid, dst, NULL, NULL))
+		return FALSE;
+#endif
+
+	_Viv2DOpMarkDst(dst);
 
+#ifdef VIV2D_COMPOSITE_BATCH
+	_Viv2DOpFlushPending(v2d);
+#endif
 	_Viv2DOpInit(&v2d->op);
 	v2d->op.mask = (uint32_t)planemask;
 	v2d->op.fg = Viv2DColour(fg, pPixmap->drawable.depth);
 	v2d->op.dst = dst;
+	dst->color = fg; // known once a rect covers the pixmap
 
 	VIV2D_DBG_MSG("Viv2DPrepareSolid dst:%p/%p %dx%d, fg:%08x mask:%08x depth:%d alu:%d", pPixmap,
 	              dst, pPixmap->drawable.width, pPixmap->drawable.height, v2d->op.fg ,
 	              v2d->op.mask, pPixmap->drawable.depth, alu);
 
+	if (_Viv2DPixIsLarge(dst)) {
+		// states are streamed per tile
+		v2d->op.split = TRUE;
+		return TRUE;
+	}
+
 #ifdef VIV2D_SOLID_FILL_BRUSH
 	_Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES);
 #else
@@ -1108,16 +1464,32 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap,
  */
 static void Viv2DSolid (PixmapPtr pPixmap, int x1, int y1, int x2, int y2) {
 	Viv2DRec *v2d = Viv2DPrivFromPixmap(pPixmap);
-	if (v2d->op.cur_rect >= VIV2D_MAX_RECTS)
-	{
-		_Viv2DStreamReserve(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-		_Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-		_Viv2DStreamCacheFlush(v2d);
 
-		v2d->op.cur_rect = 0;
+	if (v2d->op.split) {
+		Viv2DRect rect = {x1, y1, x2, y2};
+#ifdef VIV2D_SOLID_FILL_BRUSH
+		_Viv2DStreamCompTiled(v2d, viv2d_src_brush_fill, NULL, NULL, v2d->op.fg, v2d->op.dst, NULL,
+		                      FALSE, 0, FALSE, 0, 0, 0, &rect);
+#else
+		_Viv2DStreamCompTiled(v2d, viv2d_src_clear, NULL, NULL, v2d->op.fg, v2d->op.dst, NULL,
+		                      FALSE, 0, FALSE, 0, 0, 0, &rect);
+#endif
+	} else {
+		if (v2d->op.cur_rect >= VIV2D_MAX_RECTS)
+		{
+			_Viv2DStreamReserve(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
+			_Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+			_Viv2DStreamCacheFlush(v2d);
+
+			v2d->op.cur_rect = 0;
+		}
+
+		_Viv2DOpAddRect(&v2d->op, x1, y1, x2 - x1, y2 - y1);
 	}
 
-	_Viv2DOpAddRect(&v2d->op, x1, y1, x2 - x1, y2 - y1);
+	if (x1 <= 0 && y1 <= 0 && x2 >= pPixmap->drawable.width && y2 >= pPixmap->drawable.height)
+		v2d->op.dst->has_color = TRUE;
+
 	VIV2D_DBG_MSG("Viv2DSolid dst:%p %dx%d:%dx%d %d", v2d->op.dst, x1, y1, x2, y2, v2d->op.cur_rect);
 }
 
@@ -1168,6 +1540,22 @@ PrepareSolidFail(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fill_colour)
 /** @name Copy
  * @{
  */
+static void Viv2DCopyStates(Viv2DPtr v2d) {
+	if (v2d->op.blend_op) {
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES);
+	} else {
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES);
+	}
+
+#ifdef VIV2D_COPY_SRC_RELATIVE
+	_Viv2DStreamSrcRelative(v2d, v2d->op.src);
+#else
+	_Viv2DStreamSrc(v2d, v2d->op.src);
+#endif
+	_Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOp(v2d, v2d->op.blend_op, FALSE, 0, FALSE, 0);
+}
+
 /**
  * PrepareCopy() sets up the driver for doing a copy within video
  * memory.
@@ -1234,10 +1622,26 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap,
 //		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareCopy unsupported dst A8 dst:%p/%p", pDstPixmap, dst);
 		return FALSE;
 	}
+#else
+	if (dst->format.fmt == DE_FORMAT_A8 && !v2d->caps.a8_dst)
+		return FALSE;
+#endif
+#ifdef VIV2D_SUPPORT_MONO
+	// mono is a source only format
+	if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+		return FALSE;
+#endif
+
+#ifdef VIV2D_COST_MODEL
+	if (!Viv2DCostUseGPU(v2d, viv2d_cost_copy, dst, src, NULL))
+		return FALSE;
 #endif
 
-	dst->refcnt++;
+	_Viv2DOpMarkDst(dst);
 
+#ifdef VIV2D_COMPOSITE_BATCH
+	_Viv2DOpFlushPending(v2d);
+#endif
 	_Viv2DOpInit(&v2d->op);
 	v2d->op.mask = (uint32_t)planemask;
 	v2d->op.src = src;
@@ -1248,15 +1652,13 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap,
 	v2d->op.blend_op = NULL;
 #endif
 
-	if (v2d->op.blend_op) {
-		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES);
-	} else {
-		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES);
+	if (_Viv2DPixIsLarge(src) || _Viv2DPixIsLarge(dst)) {
+		// states are streamed per tile
+		v2d->op.split = TRUE;
+		return TRUE;
 	}
 
-	_Viv2DStreamSrc(v2d, v2d->op.src);
-	_Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
-	_Viv2DStreamBlendOp(v2d, v2d->op.blend_op, FALSE, 0, FALSE, 0);
+	Viv2DCopyStates(v2d);
 
 	VIV2D_DBG_MSG("Viv2DPrepareCopy  src:%p/%p(%dx%d)[%s/%s] dst:%p/%p(%dx%d)[%s/%s] dir:%dx%d alu:%d planemask:%x",
 	              pSrcPixmap, src, src->width, src->height, Viv2DFormatColorStr(&src->format), Viv2DFormatSwizzleStr(&src->format),
@@ -1266,6 +1668,95 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap,
 	return TRUE;
 };
 
+// stream the rects of the current srcX,srcY (or offset) group
+static void Viv2DCopyFlushRects(Viv2DPtr v2d) {
+	if (v2d->op.cur_rect > 0) {
+		// create states for srcX,srcY group
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
+		_Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
+		_Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+		_Viv2DStreamCacheFlush(v2d);
+
+		v2d->op.cur_rect = 0;
+	}
+}
+
+static void Viv2DCopyRect(Viv2DPtr v2d, int srcX, int srcY, int dstX, int dstY, int width, int height) {
+	Viv2DRect rect = {dstX, dstY, dstX + width, dstY + height};
+
+	if (v2d->op.split) {
+		_Viv2DStreamCompTiled(v2d, viv2d_src_pix, v2d->op.src, &v2d->op.src->format, 0, v2d->op.dst, v2d->op.blend_op,
+		                      FALSE, 0, FALSE, 0, srcX, srcY, &rect);
+	} else {
+#ifdef VIV2D_COPY_SRC_RELATIVE
+		_Viv2DStreamCompRects(v2d, viv2d_src_pix, srcX - dstX, srcY - dstY, width, height, &rect, 1);
+#else
+		_Viv2DStreamCompRects(v2d, viv2d_src_pix, srcX, srcY, width, height, &rect, 1);
+#endif
+	}
+}
+
+#define VIV2D_COPY_MAX_BANDS 64
+
+/*
+ * copy between overlapping parts of the same pixmap. The blitter walks from
+ * top left to bottom right, the rect is split in bands as thick as the move,
+ * each band does not overlap its own source and bands are streamed starting
+ * with the one farthest in the direction of the move, each one in its own
+ * DRAW_2D. Small moves of big rects make too many bands, the rect then goes
+ * through a tmp pixmap.
+ */
+static void Viv2DCopyOverlap(Viv2DPtr v2d, int srcX, int srcY, int dstX, int dstY, int width, int height) {
+	int dx = dstX - srcX;
+	int dy = dstY - srcY;
+	int band, size, i, n;
+
+	// previous rects may be read by the bands
+	Viv2DCopyFlushRects(v2d);
+
+	band = dy ? abs(dy) : abs(dx);
+	size = dy ? height : width;
+	n = (size + band - 1) / band;
+
+	if (n > VIV2D_COPY_MAX_BANDS) {
+		Viv2DPixmapPrivPtr tmp;
+		Viv2DRect trect = {0, 0, width, height};
+		Viv2DRect drect = {dstX, dstY, dstX + width, dstY + height};
+
+		tmp = _Viv2DOpCreateTmpPix(v2d, width, height, v2d->op.src->format.bpp);
+		tmp->format = v2d->op.src->format;
+
+		_Viv2DStreamCompTiled(v2d, viv2d_src_pix, v2d->op.src, &v2d->op.src->format, 0, tmp, NULL,
+		                      FALSE, 0, FALSE, 0, srcX, srcY, &trect);
+		_Viv2DStreamCompTiled(v2d, viv2d_src_pix, tmp, &tmp->format, 0, v2d->op.dst, v2d->op.blend_op,
+		                      FALSE, 0, FALSE, 0, 0, 0, &drect);
+
+		_Viv2DOpDelTmpPix(v2d, tmp);
+
+		// restore the states of the batched rects
+		if (!v2d->op.split)
+			Viv2DCopyStates(v2d);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		int pos = (dy > 0 || (!dy && dx > 0)) ? size - (i + 1) * band : i * band;
+		int len = band;
+
+		if (pos < 0) {
+			len += pos;
+			pos = 0;
+		}
+		if (pos + len > size)
+			len = size - pos;
+
+		if (dy)
+			Viv2DCopyRect(v2d, srcX, srcY + pos, dstX, dstY + pos, width, len);
+		else
+			Viv2DCopyRect(v2d, srcX + pos, srcY, dstX + pos, dstY, len, height);
+	}
+}
+
 /**
  * Copy() performs a copy set up in the last PrepareCopy call.
  *
@@ -1295,19 +1786,27 @@ static void Viv2DCopy (PixmapPtr pDstPixmap,
                        int srcY, int dstX, int dstY, int width, int height) {
 	Viv2DRec *v2d = Viv2DPrivFromPixmap(pDstPixmap);
 
+	if (v2d->op.src == v2d->op.dst && (srcX != dstX || srcY != dstY) &&
+	        abs(dstX - srcX) < width && abs(dstY - srcY) < height) {
+		Viv2DCopyOverlap(v2d, srcX, srcY, dstX, dstY, width, height);
+		return;
+	}
+
+	if (v2d->op.split) {
+		Viv2DCopyRect(v2d, srcX, srcY, dstX, dstY, width, height);
+		return;
+	}
+
+#ifdef VIV2D_COPY_SRC_RELATIVE
+	// the origin is the src to dst offset, the same for all the boxes of a CopyArea
+	srcX -= dstX;
+	srcY -= dstY;
+#endif
+
 	// new srcX,srcY group
 	if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || v2d->op.cur_rect >= VIV2D_MAX_RECTS) {
 		// stream previous rects
-		if (v2d->op.prev_src_x > -1) {
-			// create states for srcX,srcY group
-			_Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-			_Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
-			_Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-			_Viv2DStreamCacheFlush(v2d);
-
-			v2d->op.cur_rect = 0;
-		}
-
+		Viv2DCopyFlushRects(v2d);
 	}
 
 	_Viv2DOpAddRect(&v2d->op, dstX, dstY, width, height);
@@ -1338,10 +1837,7 @@ static void Viv2DDoneCopy (PixmapPtr pDstPixmap) {
 
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
-	_Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-	_Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
-	_Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-	_Viv2DStreamCacheFlush(v2d);
+	Viv2DCopyFlushRects(v2d);
 
 	VIV2D_DBG_MSG("Viv2DDoneCopy dst:%p/%p %d", pDstPixmap, v2d->op.dst, v2d->stream->offset);
 
@@ -1446,11 +1942,34 @@ Viv2DCheckComposite (int op,
 		return FALSE;
 	}
 
+#ifdef VIV2D_SUPPORT_MONO
+	// a1 pictures are in X bitmap bit order, they are only expanded by the GC ops
+	if (src_fmt.fmt == DE_FORMAT_MONOCHROME || dst_fmt.fmt == DE_FORMAT_MONOCHROME) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported a1 picture src:%s dst:%s", pix_format_name(pSrcPicture->format), pix_format_name(pDstPicture->format));
+		return FALSE;
+	}
+#endif
+
 #ifndef VIV2D_SUPPORT_A8_DST
 	if (dst_fmt.fmt == DE_FORMAT_A8) {
 //		VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported dst A8 dst:%p", pDst);
 		return FALSE;
 	}
+#else
+	if (dst_fmt.fmt == DE_FORMAT_A8) {
+		if (!Viv2DPrivFromPixmap(pDst)->caps.a8_dst) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported dst A8 on this GPU dst:%p", pDst);
+			return FALSE;
+		}
+		if (!Viv2DA8DstOp(op)) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported op with dst A8 dst:%p op:%s", pDst, pix_op_name(op));
+			return FALSE;
+		}
+		if (pMaskPicture && pMaskPicture->componentAlpha) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported component alpha with dst A8 dst:%p", pDst);
+			return FALSE;
+		}
+	}
 #endif
 
 	/*For forward compatibility*/
@@ -1488,11 +2007,30 @@ Viv2DCheckComposite (int op,
 
 	if (pMaskPicture) {
 
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+		if (pMaskPicture->componentAlpha && !Viv2DComponentAlphaOp(op)) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported op with component alpha op:%s", pix_op_name(op));
+			return FALSE;
+		}
+		// per component blending needs the PE20 COLOR modes
+		if (pMaskPicture->componentAlpha && !Viv2DPrivFromPixmap(pDst)->caps.pe20) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported component alpha without PE20");
+			return FALSE;
+		}
+#endif
+
 		if (!Viv2DGetPictureFormat(pMaskPicture->format, &msk_fmt)) {
 			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported mask format msk:%p %s", pMask, pix_format_name(pMaskPicture->format));
 			return FALSE;
 		}
 
+#ifdef VIV2D_SUPPORT_MONO
+		if (msk_fmt.fmt == DE_FORMAT_MONOCHROME) {
+			VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported a1 mask msk:%p", pMask);
+			return FALSE;
+		}
+#endif
+
 #ifndef VIV2D_SUPPORT_A8_MASK
 		if (msk_fmt.fmt == DE_FORMAT_A8 && PICT_FORMAT_A(pDstPicture->format) != 0)
 		{
@@ -1565,6 +2103,63 @@ Viv2DCheckComposite (int op,
 	return TRUE;
 }
 
+#ifdef VIV2D_COMPOSITE_BATCH
+/*
+ * the composite left open by DoneComposite has the same states as this one,
+ * its rects can be appended. GPU writes to src or msk in between have
+ * streamed the pending rects, CPU accesses and destroys flush them, the bos
+ * are compared too. 1x1 repeat sources drawn as solid are read again, the
+ * caller checks the op is still pending after that.
+ */
+static Bool Viv2DCompositeCompatible(Viv2DOp *op, int rop, PicturePtr pSrcPicture,
+                                     PicturePtr pMaskPicture, PicturePtr pDstPicture,
+                                     PixmapPtr pSrc, PixmapPtr pMask,
+                                     Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr msk, Viv2DPixmapPrivPtr dst) {
+	if (op->blend_op != &viv2d_blend_op[rop] || op->dst != dst || op->dst_exa_fmt != pDstPicture->format)
+		return FALSE;
+
+	if (op->src != src || op->src_bo != (src ? src->bo : NULL) ||
+	        op->src_fmt.exaFmt != pSrcPicture->format || op->src_repeat != pSrcPicture->repeat)
+		return FALSE;
+
+	if (!src && (pSrcPicture->pSourcePict->type != SourcePictTypeSolidFill ||
+	             op->fg != Viv2DColour(pSrcPicture->pSourcePict->solidFill.color, op->src_fmt.depth)))
+		return FALSE;
+
+	if (op->has_mask != (pMaskPicture != NULL))
+		return FALSE;
+
+	if (pMaskPicture) {
+		if (op->msk != msk || op->msk_bo != (msk ? msk->bo : NULL) ||
+		        op->msk_fmt.exaFmt != pMaskPicture->format || op->msk_repeat != pMaskPicture->repeat)
+			return FALSE;
+
+		if (op->has_component_alpha != (pMaskPicture->componentAlpha != 0))
+			return FALSE;
+
+		if (!msk && (pMaskPicture->pSourcePict->type != SourcePictTypeSolidFill ||
+		             op->mask != Viv2DColour(pMaskPicture->pSourcePict->solidFill.color, op->msk_fmt.depth)))
+			return FALSE;
+	}
+
+#ifdef VIV2D_1X1_REPEAT_AS_SOLID
+	if (src && op->src_type == viv2d_src_clear) {
+		CARD32 pixel;
+		if (!Viv2DGetFirstPixel(&pSrc->drawable, &pixel) || op->fg != Viv2DColour(pixel, op->src_fmt.depth))
+			return FALSE;
+	}
+
+	if (msk && op->msk_type == viv2d_src_clear) {
+		CARD32 pixel;
+		if (!Viv2DGetFirstPixel(&pMask->drawable, &pixel) || op->mask != Viv2DColour(pixel, op->msk_fmt.depth))
+			return FALSE;
+	}
+#endif
+
+	return TRUE;
+}
+#endif
+
 /**
  * PrepareComposite() sets up the driver for doing a Composite operation
  * described in the Render extension protocol spec.
@@ -1679,7 +2274,37 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 		return FALSE;
 	}
 
-	dst->refcnt++;
+	if (_Viv2DPixIsLarge(msk)) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareComposite unsupported large msk %dx%d", msk->width, msk->height);
+		return FALSE;
+	}
+
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+	// component alpha passes are not split
+	if (pMaskPicture && pMaskPicture->componentAlpha && (_Viv2DPixIsLarge(dst) || _Viv2DPixIsLarge(src))) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareComposite unsupported component alpha with large dst:%dx%d", dst->width, dst->height);
+		return FALSE;
+	}
+#endif
+
+#ifdef VIV2D_COST_MODEL
+	if (!Viv2DCostUseGPU(v2d, viv2d_cost_composite, dst, src, msk))
+		return FALSE;
+#endif
+
+	_Viv2DOpMarkDst(dst);
+
+#ifdef VIV2D_COMPOSITE_BATCH
+	if (v2d->op.pending) {
+		if (Viv2DCompositeCompatible(&v2d->op, rop, pSrcPicture, pMaskPicture, pDstPicture, pSrc, pMask, src, msk, dst) &&
+		        v2d->op.pending) {
+			// states already streamed, Composite appends to the open rects
+			v2d->op.pending = FALSE;
+			return TRUE;
+		}
+		_Viv2DOpFlushPending(v2d);
+	}
+#endif
 
 	_Viv2DOpInit(&v2d->op);
 
@@ -1701,9 +2326,15 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 
 	if (pSrc != NULL && pSrcPicture->repeat && pSrc->drawable.width == 1 && pSrc->drawable.height == 1) {
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
+		CARD32 pixel;
 // armada way
-		v2d->op.src_type = viv2d_src_clear;
-		v2d->op.fg = Viv2DColour(Viv2DGetFirstPixel(&pSrc->drawable), src_fmt.depth);
+		if (Viv2DGetFirstPixel(&pSrc->drawable, &pixel)) {
+			v2d->op.src_type = viv2d_src_clear;
+			v2d->op.fg = Viv2DColour(pixel, src_fmt.depth);
+		} else {
+			// still rendering, let the GPU read it
+			v2d->op.src_type = viv2d_src_stretch;
+		}
 #else
 		v2d->op.src_type = viv2d_src_stretch;
 #endif
@@ -1724,9 +2355,14 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 
 		if (pMask != NULL && pMaskPicture->repeat && pMask->drawable.width == 1 && pMask->drawable.height == 1) {
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
+			CARD32 pixel;
 // armada way
-			v2d->op.msk_type = viv2d_src_clear;
-			v2d->op.mask = Viv2DColour(Viv2DGetFirstPixel(&pMask->drawable), msk_fmt.depth);
+			if (Viv2DGetFirstPixel(&pMask->drawable, &pixel)) {
+				v2d->op.msk_type = viv2d_src_clear;
+				v2d->op.mask = Viv2DColour(pixel, msk_fmt.depth);
+			} else {
+				v2d->op.msk_type = viv2d_src_stretch;
+			}
 #else
 			v2d->op.msk_type = viv2d_src_stretch;
 #endif
@@ -1751,6 +2387,12 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 	v2d->op.src = src;
 	v2d->op.dst = dst;
 	v2d->op.msk = msk;
+	v2d->op.src_bo = src ? src->bo : NULL;
+	v2d->op.msk_bo = msk ? msk->bo : NULL;
+
+	v2d->op.dst_exa_fmt = pDstPicture->format;
+	v2d->op.src_repeat = pSrcPicture->repeat;
+	v2d->op.msk_repeat = pMaskPicture ? pMaskPicture->repeat : FALSE;
 
 #ifdef VIV2D_MASK_COMPONENT_SUPPORT
 	if (pMaskPicture && pMaskPicture->componentAlpha) {
@@ -1764,6 +2406,20 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 		// VIV2D_INFO_MSG("set src global alpha %d has_mask:%d", v2d->op.src_alpha, v2d->op.has_mask);
 	}
 
+	if (_Viv2DPixIsLarge(dst) || (v2d->op.src_type == viv2d_src_pix && _Viv2DPixIsLarge(src))) {
+		// states are streamed per tile
+		v2d->op.split = TRUE;
+	}
+
+#ifdef VIV2D_SOLID_A8_MASK
+	// text: the A8 mask is the blit source, the solid color is the global color
+	if (v2d->caps.pe20 && v2d->op.has_mask && !v2d->op.has_component_alpha && !v2d->op.split &&
+	        v2d->op.src_type == viv2d_src_clear &&
+	        v2d->op.msk_type == viv2d_src_pix && msk_fmt.fmt == DE_FORMAT_A8) {
+		v2d->op.solid_msk = TRUE;
+	}
+#endif
+
 #ifdef VIV2D_DEBUG
 
 	if (pSrcPicture != NULL) {
@@ -1825,7 +2481,7 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 	}
 #endif
 
-	if (!v2d->op.has_mask) {
+	if (!v2d->op.has_mask && !v2d->op.split) {
 		int reserve = 0;
 		switch (v2d->op.src_type) {
 		case viv2d_src_stretch:
@@ -1875,6 +2531,17 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 		_Viv2DStreamBlendOp(v2d, v2d->op.blend_op, FALSE, 0, FALSE, 0);
 	}
 
+#ifdef VIV2D_SOLID_A8_MASK
+	if (v2d->op.solid_msk) {
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES);
+		_Viv2DStreamSrcWithFormat(v2d, v2d->op.msk, &v2d->op.msk_fmt);
+		_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+		_Viv2DStreamBlendOpGlobalColor(v2d, v2d->op.blend_op, Viv2DUnpremultiply(v2d->op.fg),
+		                               VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_ENABLE |
+		                               VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_COLOR);
+	}
+#endif
+
 	return TRUE;
 }
 
@@ -1903,6 +2570,84 @@ Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
      * This call is required if PrepareComposite() ever succeeds.
      */
 // dest = (source IN mask) OP dest
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+/* solid src IN mask per component, blended with blend_op, mask as source */
+static void Viv2DStreamSolidComponent(Viv2DPtr v2d, Viv2DBlendOp *blend_op, uint32_t multiply,
+                                      int maskX, int maskY, int width, int height, Viv2DRect *drect) {
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+	_Viv2DStreamSrcWithFormat(v2d, v2d->op.msk, &v2d->op.msk_fmt);
+	_Viv2DStreamSrcOrigin(v2d, maskX, maskY, width, height);
+	_Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOpGlobalColor(v2d, blend_op, v2d->op.fg, multiply);
+	_Viv2DStreamRects(v2d, drect, 1);
+	_Viv2DStreamCacheFlush(v2d);
+}
+
+/*
+ * component alpha composite, return FALSE if left to the generic mask path
+ * - solid src : the mask is the source and the color the global color, one
+ *   pass, plus the OutReverse pass for Over
+ * - Over : two passes, each one through a tmp
+ */
+static Bool Viv2DCompositeComponent(Viv2DPtr v2d, int srcX, int srcY, int maskX, int maskY,
+                                    int width, int height, Viv2DRect *mrect, Viv2DRect *drect) {
+	Viv2DBlendOp out_op = {PictOpOutReverse, DE_BLENDMODE_ZERO, DE_BLENDMODE_COLOR_INVERSED};
+	Viv2DBlendOp msk_op = {PictOpInReverse, DE_BLENDMODE_ZERO, DE_BLENDMODE_COLOR};
+	Bool over = v2d->op.blend_op->op == PictOpOver;
+	Viv2DPixmapPrivPtr tmp;
+
+	if (v2d->op.src_type == viv2d_src_clear && v2d->op.msk_type == viv2d_src_pix) {
+		if (over)
+			Viv2DStreamSolidComponent(v2d, &out_op, VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_ALPHA,
+			                          maskX, maskY, width, height, drect);
+
+		Viv2DStreamSolidComponent(v2d, over ? &viv2d_blend_op[PictOpAdd] : v2d->op.blend_op,
+		                          VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_COLOR,
+		                          maskX, maskY, width, height, drect);
+		return TRUE;
+	}
+
+	if (!over)
+		return FALSE;
+
+	tmp = _Viv2DOpCreateTmpPix(v2d, width, height, 32);
+	_Viv2DSetFormat(32, 32, &tmp->format); // A8R8G8B8
+
+	// tmp = src.a * mask
+	_Viv2DStreamCompAlpha(v2d, v2d->op.msk_type, v2d->op.msk, &v2d->op.msk_fmt, v2d->op.mask, tmp, &viv2d_blend_op[PictOpSrc],
+	                      v2d->op.msk_alpha_mode_global, v2d->op.msk_alpha,
+	                      FALSE, 0,
+	                      maskX, maskY, width, height, mrect, 1);
+	_Viv2DStreamCompAlpha(v2d, v2d->op.src_type, v2d->op.src, &v2d->op.src_fmt, v2d->op.fg, tmp, &viv2d_blend_op[PictOpInReverse],
+	                      v2d->op.src_alpha_mode_global, v2d->op.src_alpha,
+	                      FALSE, 0,
+	                      srcX, srcY, width, height, mrect, 1);
+	// dst = dst * (1 - tmp)
+	_Viv2DStreamCompAlpha(v2d, viv2d_src_pix, tmp, &tmp->format, 0, v2d->op.dst, &out_op,
+	                      FALSE, 0,
+	                      v2d->op.dst_alpha_mode_global, v2d->op.dst_alpha,
+	                      0, 0, width, height, drect, 1);
+
+	// tmp = src * mask
+	_Viv2DStreamCompAlpha(v2d, v2d->op.src_type, v2d->op.src, &v2d->op.src_fmt, v2d->op.fg, tmp, &viv2d_blend_op[PictOpSrc],
+	                      v2d->op.src_alpha_mode_global, v2d->op.src_alpha,
+	                      FALSE, 0,
+	                      srcX, srcY, width, height, mrect, 1);
+	_Viv2DStreamCompAlpha(v2d, v2d->op.msk_type, v2d->op.msk, &v2d->op.msk_fmt, v2d->op.mask, tmp, &msk_op,
+	                      v2d->op.msk_alpha_mode_global, v2d->op.msk_alpha,
+	                      FALSE, 0,
+	                      maskX, maskY, width, height, mrect, 1);
+	// dst = dst + tmp
+	_Viv2DStreamCompAlpha(v2d, viv2d_src_pix, tmp, &tmp->format, 0, v2d->op.dst, &viv2d_blend_op[PictOpAdd],
+	                      FALSE, 0,
+	                      v2d->op.dst_alpha_mode_global, v2d->op.dst_alpha,
+	                      0, 0, width, height, drect, 1);
+
+	_Viv2DOpDelTmpPix(v2d, tmp);
+	return TRUE;
+}
+#endif
+
 static void
 Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
                int dstX, int dstY, int width, int height) {
@@ -1919,7 +2664,19 @@ Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 	drect[0].x2 = dstX + width;
 	drect[0].y2 = dstY + height;
 
-	if (v2d->op.has_mask) {
+	if (v2d->op.solid_msk) {
+		// mask is the source
+		srcX = maskX;
+		srcY = maskY;
+	}
+
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+	if (v2d->op.has_component_alpha &&
+	        Viv2DCompositeComponent(v2d, srcX, srcY, maskX, maskY, width, height, mrect, drect)) {
+		// done
+	} else
+#endif
+	if (v2d->op.has_mask && !v2d->op.solid_msk) {
 		// tmp 32bits argb pix
 		Viv2DPixmapPrivPtr tmp;
 
@@ -1941,22 +2698,42 @@ Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 //			cpy_op = NULL;
 		}
 
-		_Viv2DStreamCompAlpha(v2d, v2d->op.src_type, v2d->op.src, &v2d->op.src_fmt, v2d->op.fg, tmp, cpy_op,
-		                      v2d->op.src_alpha_mode_global, v2d->op.src_alpha,
-		                      FALSE, 0,
-		                      srcX, srcY, width, height, mrect, 1);
-
-		_Viv2DStreamCompAlpha(v2d, v2d->op.msk_type, v2d->op.msk, &v2d->op.msk_fmt, v2d->op.mask, tmp, &msk_op,
-		                      v2d->op.msk_alpha_mode_global, v2d->op.msk_alpha,
-		                      FALSE, 0,
-		                      maskX, maskY, width, height, mrect, 1);
+#ifdef VIV2D_MULTI_SOURCE
+		if (v2d->caps.multi_source && !v2d->op.split && !v2d->op.has_component_alpha &&
+		        v2d->op.src_type == viv2d_src_pix && v2d->op.msk_type == viv2d_src_pix) {
+			// tmp = src, then tmp IN mask, in one blit
+			_Viv2DStreamReserve(v2d, VIV2D_MULTI_SRC_RES * 2 + VIV2D_MULTI_SOURCE_RES + VIV2D_DEST_RES +
+			                    VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+			_Viv2DStreamMultiSrc(v2d, 0, v2d->op.src, &v2d->op.src_fmt, srcX, srcY, width, height, cpy_op);
+			_Viv2DStreamMultiSrc(v2d, 1, v2d->op.msk, &v2d->op.msk_fmt, maskX, maskY, width, height, &msk_op);
+			_Viv2DStreamMultiSource(v2d, 2);
+			_Viv2DStreamDst(v2d, tmp, VIVS_DE_DEST_CONFIG_COMMAND_MULTI_SOURCE_BLT, ROP_SRC, NULL);
+			_Viv2DStreamRects(v2d, mrect, 1);
+			_Viv2DStreamCacheFlush(v2d);
+		} else
+#endif
+		{
+			_Viv2DStreamCompTiled(v2d, v2d->op.src_type, v2d->op.src, &v2d->op.src_fmt, v2d->op.fg, tmp, cpy_op,
+			                      v2d->op.src_alpha_mode_global, v2d->op.src_alpha,
+			                      FALSE, 0,
+			                      srcX, srcY, mrect);
+
+			_Viv2DStreamCompAlpha(v2d, v2d->op.msk_type, v2d->op.msk, &v2d->op.msk_fmt, v2d->op.mask, tmp, &msk_op,
+			                      v2d->op.msk_alpha_mode_global, v2d->op.msk_alpha,
+			                      FALSE, 0,
+			                      maskX, maskY, width, height, mrect, 1);
+		}
 
-		_Viv2DStreamCompAlpha(v2d, viv2d_src_pix, tmp, &tmp->format, 0, v2d->op.dst, v2d->op.blend_op,
+		_Viv2DStreamCompTiled(v2d, viv2d_src_pix, tmp, &tmp->format, 0, v2d->op.dst, v2d->op.blend_op,
 		                      FALSE, 0,
 		                      v2d->op.dst_alpha_mode_global, v2d->op.dst_alpha,
-		                      0, 0, width, height, drect, 1);
+		                      0, 0, drect);
 
 		_Viv2DOpDelTmpPix(v2d, tmp);
+	} else if (v2d->op.split) {
+		_Viv2DStreamCompTiled(v2d, v2d->op.src_type, v2d->op.src, &v2d->op.src_fmt, v2d->op.fg, v2d->op.dst, v2d->op.blend_op,
+		                      FALSE, 0, FALSE, 0,
+		                      srcX, srcY, drect);
 	} else {
 		// new srcX,srcY group
 		if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || v2d->op.cur_rect >= VIV2D_MAX_RECTS)
@@ -2005,9 +2782,15 @@ static void Viv2DDoneComposite (PixmapPtr pDst) {
 
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
-	if (v2d->op.has_mask) {
+	if (v2d->op.has_mask && !v2d->op.solid_msk) {
 		VIV2D_DBG_MSG("Viv2DDoneComposite with msk dst:%p %d", pDst, v2d->stream->offset);
 		// already done masked operations
+#ifdef VIV2D_COMPOSITE_BATCH
+	} else if (!v2d->op.split) {
+		// last rects are streamed by the next operation, with the ones of
+		// the next composite if compatible
+		v2d->op.pending = TRUE;
+#endif
 	} else {
 		// last op
 		if (v2d->op.cur_rect > 0) {
@@ -2055,8 +2838,34 @@ CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	DeleteCallback(&FlushCallback, Viv2DFlushCallback, pScrn);
 #endif
 
+#ifdef VIV2D_GC
+	Viv2DGCScreenFini(pScreen);
+#endif
+#ifdef VIV2D_GRADIENT_CACHE
+	Viv2DGradientScreenFini(pScreen);
+#endif
+#ifdef VIV2D_CAPTURE
+	Viv2DCaptureScreenFini(pScreen);
+#endif
+#ifdef VIV2D_GLYPH_ATLAS
+	Viv2DGlyphScreenFini(pScreen);
+#endif
+#ifdef VIV2D_TRAPEZOID_MASK
+	Viv2DTrapScreenFini(pScreen);
+#endif
+#ifdef VIV2D_DEFER_ACCESS
+	Viv2DDeferScreenFini(pScreen);
+#endif
+
 	_Viv2DStreamCommit(v2d, FALSE);
 
+#ifdef VIV2D_UPLOAD_TO_SCREEN
+	Viv2DUploadFini(v2d);
+#endif
+#ifdef VIV2D_DOWNLOAD_FROM_SCREEN
+	Viv2DReadbackFini(v2d);
+#endif
+	free(v2d->usermem.bo);
 	etna_bo_del(v2d->bo);
 	etna_cmd_stream_del(v2d->stream);
 	etna_pipe_del(v2d->pipe);
@@ -2195,6 +3004,10 @@ static Bool Viv2DPutTextureImage(PixmapPtr pSrcPix, BoxPtr pSrcBox,
 	if (!src->bo || !dst->bo)
 		return FALSE;
 
+	// the filter blits are not split in tiles, the caller falls back
+	if (_Viv2DPixIsLarge(src) || _Viv2DPixIsLarge(dst))
+		return FALSE;
+
 	s_w = pSrcPix->drawable.width;
 	s_h = pSrcPix->drawable.height;
 	d_w = fullDstBox->x2 - fullDstBox->x1;
@@ -2348,6 +3161,33 @@ static Bool Viv2DPutTextureImage(PixmapPtr pSrcPix, BoxPtr pSrcBox,
 }
 #endif
 
+/*
+ * The paths depending on the GPU revision are decided at runtime from the
+ * feature words, the viv2d_config.h flags only allow them.
+ */
+static void Viv2DInitCaps(ScrnInfoPtr pScrn, Viv2DPtr v2d) {
+	uint64_t features[VIV2D_FEATURE_WORDS];
+	Viv2DCaps *caps = &v2d->caps;
+	int i;
+
+	for (i = 0; i < VIV2D_FEATURE_WORDS; i++) {
+		if (etna_gpu_get_param(v2d->gpu, ETNA_GPU_FEATURES_0 + i, &features[i]))
+			features[i] = 0;
+	}
+
+	caps->pe20 = (features[1] & VIV2D_FEATURE_2DPE20) ? TRUE : FALSE;
+	caps->a8_dst = caps->pe20 && (features[1] & VIV2D_FEATURE_2D_A8_TARGET);
+	caps->multi_source = (features[3] & VIV2D_FEATURE_2D_MULTI_SOURCE_BLIT) ? TRUE : FALSE;
+
+#ifndef VIV2D_MULTI_SOURCE
+	caps->multi_source = FALSE;
+#endif
+
+	INFO_MSG("Viv2DEXA: features %08x %08x %08x %08x pe20:%d a8 dst:%d multi source:%d",
+	         (uint32_t)features[0], (uint32_t)features[1], (uint32_t)features[2], (uint32_t)features[3],
+	         caps->pe20, caps->a8_dst, caps->multi_source);
+}
+
 struct ARMSOCEXARec *
 InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 {
@@ -2386,6 +3226,8 @@ InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	etna_gpu_get_param(v2d->gpu, ETNA_GPU_REVISION, &revision);
 	INFO_MSG("Viv2DEXA: Vivante GC%x GPU revision %x found !", (uint32_t)model, (uint32_t)revision);
 
+	Viv2DInitCaps(pScrn, v2d);
+
 	v2d->pipe = etna_pipe_new(v2d->gpu, ETNA_PIPE_2D);
 	if (!v2d->pipe) {
 		ERROR_MSG("Viv2DEXA: Failed to create pipe");
@@ -2398,10 +3240,21 @@ InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 		goto fail;
 	}
 
+#ifdef VIV2D_UPLOAD_TO_SCREEN
+	if (!Viv2DUploadInit(v2d)) {
+		ERROR_MSG("Viv2DEXA: Failed to create upload ring");
+		goto fail;
+	}
+#endif
+
 	scanoutFD = armsoc_bo_get_dmabuf(pARMSOC->scanout);
 	v2d->bo = etna_bo_from_dmabuf(v2d->dev, scanoutFD);
 	close(scanoutFD);
 
+#ifdef VIV2D_COST_MODEL
+	Viv2DCostCalibrate(v2d);
+#endif
+
 	v2d_exa->v2d = v2d;
 
 	exa = exaDriverAlloc();
@@ -2428,8 +3281,8 @@ InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	exa->flags = EXA_OFFSCREEN_PIXMAPS |
 	             EXA_HANDLES_PIXMAPS | EXA_SUPPORTS_PREPARE_AUX;
 
-	exa->maxX = 2048;
-	exa->maxY = 2048;
+	exa->maxX = VIV2D_MAX_WIDTH;
+	exa->maxY = VIV2D_MAX_HEIGHT;
 
 	/* Required EXA functions: */
 #ifdef VIV2D_MARKER
@@ -2497,6 +3350,48 @@ InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 		goto fail;
 	}
 
+#ifdef VIV2D_GC
+	if (!Viv2DGCScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: GC init failed");
+		goto fail;
+	}
+#endif
+
+#ifdef VIV2D_GRADIENT_CACHE
+	if (!Viv2DGradientScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: gradient cache init failed");
+		goto fail;
+	}
+#endif
+
+#ifdef VIV2D_CAPTURE
+	if (!Viv2DCaptureScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: capture init failed");
+		goto fail;
+	}
+#endif
+
+#ifdef VIV2D_GLYPH_ATLAS
+	if (!Viv2DGlyphScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: glyph atlas init failed");
+		goto fail;
+	}
+#endif
+
+#ifdef VIV2D_TRAPEZOID_MASK
+	if (!Viv2DTrapScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: trapezoid mask init failed");
+		goto fail;
+	}
+#endif
+
+#ifdef VIV2D_DEFER_ACCESS
+	if (!Viv2DDeferScreenInit(pScreen)) {
+		ERROR_MSG("Viv2DEXA: deferred access init failed");
+		goto fail;
+	}
+#endif
+
 #ifdef VIV2D_EXA_HACK
 	// Trapezoids hack
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
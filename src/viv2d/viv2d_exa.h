@@ -44,6 +44,76 @@ static inline Viv2DPixmapPrivPtr Viv2DPixmapPrivFromPixmap(PixmapPtr pPixmap){
 	return pixPriv->priv;
 }
 
+/*
+ * render ops leaving dst unchanged where src IN mask is zero : only those
+ * may skip the mask-zero pixels of a mask drawn piece by piece
+ */
+static inline Bool Viv2DOpKeepsDst(CARD8 op) {
+	switch (op) {
+	case PictOpOver:
+	case PictOpAdd:
+	case PictOpOutReverse:
+	case PictOpAtop:
+	case PictOpXor:
+	case PictOpOverReverse:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+// AllocBuf usage hint : pixmap the CPU reads, in a cached bo
+#define VIV2D_CREATE_PIXMAP_CACHED 0x40000000
+
+Bool Viv2DPrepareAccess(PixmapPtr pPixmap, int index);
+void Viv2DFinishAccess(PixmapPtr pPixmap, int index);
+
+#ifdef VIV2D_GC
+Bool Viv2DGCScreenInit(ScreenPtr pScreen);
+void Viv2DGCScreenFini(ScreenPtr pScreen);
+#endif
+
+#ifdef VIV2D_GRADIENT_CACHE
+Bool Viv2DGradientScreenInit(ScreenPtr pScreen);
+void Viv2DGradientScreenFini(ScreenPtr pScreen);
+#endif
+
+#ifdef VIV2D_CAPTURE
+Bool Viv2DCaptureScreenInit(ScreenPtr pScreen);
+void Viv2DCaptureScreenFini(ScreenPtr pScreen);
+void Viv2DCaptureFlush(Viv2DPtr v2d);
+#endif
+
+#ifdef VIV2D_GLYPH_ATLAS
+Bool Viv2DGlyphScreenInit(ScreenPtr pScreen);
+void Viv2DGlyphScreenFini(ScreenPtr pScreen);
+#endif
+
+#ifdef VIV2D_TRAPEZOID_MASK
+Bool Viv2DTrapScreenInit(ScreenPtr pScreen);
+void Viv2DTrapScreenFini(ScreenPtr pScreen);
+Bool Viv2DTrapezoidsMask(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                         INT16 xSrc, INT16 ySrc, int ntrap, xTrapezoid *traps);
+Bool Viv2DTrianglesMask(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                        INT16 xSrc, INT16 ySrc, int ntri, xTriangle *tris);
+#endif
+
+#ifdef VIV2D_DEFER_ACCESS
+Bool Viv2DDeferScreenInit(ScreenPtr pScreen);
+void Viv2DDeferScreenFini(ScreenPtr pScreen);
+#endif
+
+#ifdef VIV2D_COST_MODEL
+enum viv2d_cost_op {
+	viv2d_cost_solid,
+	viv2d_cost_copy,
+	viv2d_cost_composite
+};
+
+void Viv2DCostCalibrate(Viv2DPtr v2d);
+Bool Viv2DCostUseGPU(Viv2DPtr v2d, enum viv2d_cost_op kind, Viv2DPixmapPrivPtr dst, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr msk);
+#endif
+
 struct ARMSOCEXARec *InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd);
 
 #endif
\ No newline at end of file
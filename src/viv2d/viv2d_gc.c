@@ -0,0 +1,1083 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gcstruct.h"
+#include "privates.h"
+#include "servermd.h"
+#include "dixfontstr.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+#include "viv2d_op.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_GC
+
+/*
+EXA only accelerates core rendering that ends up in Solid or Copy, everything
+else goes through fb. The core ops below are wrapped at GC level: ValidateGC
+lets EXA pick its ops then a per GC copy of them is made with the accelerated
+entries replaced. Each accelerated entry checks if the request can be done by
+the GC320 and calls the saved op otherwise.
+*/
+
+typedef struct {
+	const GCFuncs *funcs;
+	const GCOps *ops; // ops set by the wrapped ValidateGC
+	GCOps accel_ops;
+} Viv2DGCPrivRec, *Viv2DGCPrivPtr;
+
+static DevPrivateKeyRec viv2d_gc_key;
+
+static inline Viv2DGCPrivPtr Viv2DGCPriv(GCPtr pGC) {
+	return dixGetPrivateAddr(&pGC->devPrivates, &viv2d_gc_key);
+}
+
+/* return the accelerated pixmap behind pDrawable and the offsets from screen to pixmap coordinates */
+static Viv2DPixmapPrivPtr Viv2DGCDrawablePix(DrawablePtr pDrawable, int *xoff, int *yoff) {
+	PixmapPtr pPixmap;
+	struct ARMSOCPixmapPrivRec *armsocPix;
+	Viv2DPixmapPrivPtr pix;
+
+	if (pDrawable->type == DRAWABLE_WINDOW) {
+		pPixmap = pDrawable->pScreen->GetWindowPixmap((WindowPtr)pDrawable);
+#ifdef COMPOSITE
+		*xoff = -pPixmap->screen_x;
+		*yoff = -pPixmap->screen_y;
+#else
+		*xoff = 0;
+		*yoff = 0;
+#endif
+	} else {
+		pPixmap = (PixmapPtr)pDrawable;
+		*xoff = 0;
+		*yoff = 0;
+	}
+
+	armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+	if (!armsocPix || !armsocPix->priv)
+		return NULL;
+
+	pix = armsocPix->priv;
+	if (!pix->bo) {
+		// CPU only
+		return NULL;
+	}
+
+	// the GC ops are not split in tiles, let EXA do it
+	if (_Viv2DPixIsLarge(pix))
+		return NULL;
+
+	if (!_Viv2DSetFormat(pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel, &pix->format)) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCDrawablePix unsupported format depth:%d bpp:%d", pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel);
+		return NULL;
+	}
+
+	switch (pix->format.fmt) {
+#ifdef VIV2D_SUPPORT_MONO
+	case DE_FORMAT_MONOCHROME:
+		return NULL;
+#endif
+	case DE_FORMAT_A8:
+#ifdef VIV2D_SUPPORT_A8_DST
+		if (Viv2DPrivFromScreen(pDrawable->pScreen)->caps.a8_dst)
+			break;
+#endif
+		return NULL;
+	default:
+		break;
+	}
+
+	return pix;
+}
+
+/* only plain copy with all planes */
+static inline Bool Viv2DGCSolid(DrawablePtr pDrawable, GCPtr pGC, Bool fill) {
+	if (pGC->alu != GXcopy) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCSolid unsupported alu:%d", pGC->alu);
+		return FALSE;
+	}
+
+	if (!EXA_PM_IS_SOLID(pDrawable, pGC->planemask)) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCSolid unsupported planemask:%x", (uint32_t)pGC->planemask);
+		return FALSE;
+	}
+
+	if (fill && pGC->fillStyle != FillSolid) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCSolid unsupported fill style:%d", pGC->fillStyle);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static inline Bool Viv2DBoxIntersect(BoxPtr dst, const BoxRec *a, const BoxRec *b) {
+	dst->x1 = max(a->x1, b->x1);
+	dst->y1 = max(a->y1, b->y1);
+	dst->x2 = min(a->x2, b->x2);
+	dst->y2 = min(a->y2, b->y2);
+
+	return dst->x1 < dst->x2 && dst->y1 < dst->y2;
+}
+
+static inline void Viv2DBoxUnion(BoxPtr dst, int x1, int y1, int x2, int y2) {
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	if (dst->x1 >= dst->x2 || dst->y1 >= dst->y2) {
+		dst->x1 = x1;
+		dst->y1 = y1;
+		dst->x2 = x2;
+		dst->y2 = y2;
+	} else {
+		dst->x1 = min(dst->x1, x1);
+		dst->y1 = min(dst->y1, y1);
+		dst->x2 = max(dst->x2, x2);
+		dst->y2 = max(dst->y2, y2);
+	}
+}
+
+/* fill boxes (screen coordinates) clipped by the GC composite clip */
+static void Viv2DGCFillBoxes(Viv2DPtr v2d, GCPtr pGC, Viv2DPixmapPrivPtr dst, int xoff, int yoff,
+                             BoxPtr boxes, int n, uint32_t color) {
+	BoxPtr extents = RegionExtents(pGC->pCompositeClip);
+	Viv2DRect rects[VIV2D_MAX_RECTS];
+	int cur_rect = 0;
+	BoxRec box, clip;
+
+	for (; n--; boxes++) {
+		int nbox = RegionNumRects(pGC->pCompositeClip);
+		BoxPtr pbox = RegionRects(pGC->pCompositeClip);
+
+		if (!Viv2DBoxIntersect(&box, boxes, extents))
+			continue;
+
+		for (; nbox--; pbox++) {
+			if (!Viv2DBoxIntersect(&clip, pbox, &box))
+				continue;
+
+			rects[cur_rect].x1 = clip.x1 + xoff;
+			rects[cur_rect].y1 = clip.y1 + yoff;
+			rects[cur_rect].x2 = clip.x2 + xoff;
+			rects[cur_rect].y2 = clip.y2 + yoff;
+			cur_rect++;
+
+			if (cur_rect == VIV2D_MAX_RECTS) {
+				_Viv2DStreamSolid(v2d, dst, color, rects, cur_rect);
+				cur_rect = 0;
+			}
+		}
+	}
+
+	if (cur_rect > 0)
+		_Viv2DStreamSolid(v2d, dst, color, rects, cur_rect);
+}
+
+/* pixel x of a X bitmap row */
+static inline Bool Viv2DBitmapBit(const uint8_t *row, int x) {
+#if BITMAP_BIT_ORDER == LSBFirst
+	return (row[x >> 3] & (1 << (x & 7))) != 0;
+#else
+	return (row[x >> 3] & (0x80 >> (x & 7))) != 0;
+#endif
+}
+
+#ifdef VIV2D_SUPPORT_MONO
+static inline void Viv2DMonoSetBit(uint8_t *row, int x) {
+	row[x >> 3] |= 0x80 >> (x & 7);
+}
+
+/* copy a X bitmap at dx,dy into the mono buffer, pixels outside of width x height are dropped */
+static void Viv2DMonoPutBits(uint8_t *dst, int dst_pitch, int width, int height, int dx, int dy,
+                             const uint8_t *src, int src_stride, int w, int h) {
+	int x, y;
+
+	for (y = 0; y < h; y++) {
+		const uint8_t *s = src + y * src_stride;
+		uint8_t *d;
+
+		if (dy + y < 0 || dy + y >= height)
+			continue;
+
+		d = dst + (dy + y) * dst_pitch;
+		for (x = 0; x < w; x++) {
+			if (dx + x < 0 || dx + x >= width)
+				continue;
+			if (Viv2DBitmapBit(s, x))
+				Viv2DMonoSetBit(d, dx + x);
+		}
+	}
+}
+
+static Viv2DPixmapPrivPtr Viv2DMonoCreate(Viv2DPtr v2d, int width, int height, uint8_t **bits) {
+	Viv2DPixmapPrivPtr mono = _Viv2DOpCreateTmpPix(v2d, width, height, 1);
+
+	if (!mono->bo) {
+		free(mono);
+		return NULL;
+	}
+
+	_Viv2DSetFormat(1, 1, &mono->format);
+	*bits = etna_bo_map(mono->bo);
+	memset(*bits, 0, mono->pitch * height);
+
+	return mono;
+}
+
+/*
+ * Expand mono (covering box, screen coordinates) into dst, set bits are drawn
+ * with fg, cleared bits with bg or left untouched with ROP_DST.
+ */
+static void Viv2DGCStreamMono(Viv2DPtr v2d, GCPtr pGC, Viv2DPixmapPrivPtr dst, int xoff, int yoff,
+                              Viv2DPixmapPrivPtr mono, BoxPtr box, uint32_t fg, uint32_t bg, int rop_bg) {
+	int nbox = RegionNumRects(pGC->pCompositeClip);
+	BoxPtr pbox = RegionRects(pGC->pCompositeClip);
+	Viv2DRect rect, clip;
+	BoxRec tmp;
+
+	rect.x1 = box->x1 + xoff;
+	rect.y1 = box->y1 + yoff;
+	rect.x2 = box->x2 + xoff;
+	rect.y2 = box->y2 + yoff;
+
+	for (; nbox--; pbox++) {
+		if (!Viv2DBoxIntersect(&tmp, pbox, box))
+			continue;
+
+		clip.x1 = tmp.x1 + xoff;
+		clip.y1 = tmp.y1 + yoff;
+		clip.x2 = tmp.x2 + xoff;
+		clip.y2 = tmp.y2 + yoff;
+
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_MONO_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+		_Viv2DStreamMonoSrc(v2d, mono, fg, bg);
+		_Viv2DStreamSrcOrigin(v2d, 0, 0, mono->width, mono->height);
+		_Viv2DStreamDstRop4(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, rop_bg, &clip);
+		_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0); // reset blend
+		_Viv2DStreamRects(v2d, &rect, 1);
+		_Viv2DStreamCacheFlush(v2d);
+	}
+}
+
+static Bool Viv2DGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                          unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase, Bool image) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+	Viv2DPixmapPrivPtr dst, mono;
+	BoxRec box = { 0, 0, 0, 0 };
+	BoxRec back;
+	uint8_t *bits;
+	int xoff, yoff, px, i;
+
+	if (!Viv2DGCSolid(pDrawable, pGC, !image))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	px = x;
+	for (i = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		Viv2DBoxUnion(&box, px + pci->metrics.leftSideBearing, y - pci->metrics.ascent,
+		              px + pci->metrics.rightSideBearing, y + pci->metrics.descent);
+		px += pci->metrics.characterWidth;
+	}
+
+	if (image) {
+		back.x1 = min(x, px);
+		back.x2 = max(x, px);
+		back.y1 = y - FONTASCENT(pGC->font);
+		back.y2 = y + FONTDESCENT(pGC->font);
+		Viv2DBoxUnion(&box, back.x1, back.y1, back.x2, back.y2);
+	}
+
+	if (!Viv2DBoxIntersect(&box, &box, RegionExtents(pGC->pCompositeClip)))
+		return TRUE;
+
+	mono = Viv2DMonoCreate(v2d, box.x2 - box.x1, box.y2 - box.y1, &bits);
+	if (!mono)
+		return FALSE;
+
+	px = x;
+	for (i = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		Viv2DMonoPutBits(bits, mono->pitch, mono->width, mono->height,
+		                 px + pci->metrics.leftSideBearing - box.x1, y - pci->metrics.ascent - box.y1,
+		                 FONTGLYPHBITS(pglyphBase, pci), GLYPHWIDTHBYTESPADDED(pci),
+		                 GLYPHWIDTHPIXELS(pci), GLYPHHEIGHTPIXELS(pci));
+		px += pci->metrics.characterWidth;
+	}
+
+	_Viv2DOpMarkDst(dst);
+
+	if (image)
+		Viv2DGCFillBoxes(v2d, pGC, dst, xoff, yoff, &back, 1, Viv2DColour(pGC->bgPixel, pDrawable->depth));
+
+	Viv2DGCStreamMono(v2d, pGC, dst, xoff, yoff, mono, &box,
+	                  Viv2DColour(pGC->fgPixel, pDrawable->depth), 0, ROP_DST);
+
+	VIV2D_DBG_MSG("Viv2DGlyphBlt dst:%p %dx%d:%dx%d glyphs:%d image:%d", dst, box.x1, box.y1, box.x2, box.y2, nglyph, image);
+
+	_Viv2DOpDelTmpPix(v2d, mono);
+
+	return TRUE;
+}
+
+static void Viv2DImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                               unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase, TRUE))
+		priv->ops->ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase);
+}
+
+static void Viv2DPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                              unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase, FALSE))
+		priv->ops->PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase);
+}
+
+/* x, y are screen coordinates */
+static Bool Viv2DDoPushPixels(GCPtr pGC, PixmapPtr pBitmap, DrawablePtr pDrawable, int w, int h, int x, int y) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+	Viv2DPixmapPrivPtr dst, mono;
+	BoxRec box;
+	uint8_t *bits;
+	int xoff, yoff;
+
+	if (pBitmap->drawable.depth != 1)
+		return FALSE;
+
+	if (!Viv2DGCSolid(pDrawable, pGC, TRUE))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	box.x1 = x;
+	box.y1 = y;
+	box.x2 = x + w;
+	box.y2 = y + h;
+
+	if (!Viv2DBoxIntersect(&box, &box, RegionExtents(pGC->pCompositeClip)))
+		return TRUE;
+
+	mono = Viv2DMonoCreate(v2d, box.x2 - box.x1, box.y2 - box.y1, &bits);
+	if (!mono)
+		return FALSE;
+
+	if (!Viv2DPrepareAccess(pBitmap, EXA_PREPARE_SRC)) {
+		_Viv2DOpDelTmpPix(v2d, mono);
+		return FALSE;
+	}
+	Viv2DMonoPutBits(bits, mono->pitch, mono->width, mono->height, x - box.x1, y - box.y1,
+	                 pBitmap->devPrivate.ptr, pBitmap->devKind, w, h);
+	Viv2DFinishAccess(pBitmap, EXA_PREPARE_SRC);
+
+	_Viv2DOpMarkDst(dst);
+
+	Viv2DGCStreamMono(v2d, pGC, dst, xoff, yoff, mono, &box,
+	                  Viv2DColour(pGC->fgPixel, pDrawable->depth), 0, ROP_DST);
+
+	VIV2D_DBG_MSG("Viv2DPushPixels dst:%p %dx%d:%dx%d", dst, box.x1, box.y1, box.x2, box.y2);
+
+	_Viv2DOpDelTmpPix(v2d, mono);
+
+	return TRUE;
+}
+
+static void Viv2DPushPixels(GCPtr pGC, PixmapPtr pBitmap, DrawablePtr pDrawable, int w, int h, int x, int y) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DDoPushPixels(pGC, pBitmap, pDrawable, w, h, x, y))
+		priv->ops->PushPixels(pGC, pBitmap, pDrawable, w, h, x, y);
+}
+#endif
+
+#ifdef VIV2D_FILL_PATTERN
+#define VIV2D_PATTERN_SIZE 8
+
+/* stipples and tiles of 1, 2, 4 or 8 pixels are replicated into the 8x8 pattern */
+static inline Bool Viv2DPatternSize(int width, int height) {
+	return width <= VIV2D_PATTERN_SIZE && height <= VIV2D_PATTERN_SIZE &&
+	       (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+}
+
+/* pattern origin org is in pixmap coordinates, returns the stipple/tile pixel for pattern pixel p */
+static inline int Viv2DPatternWrap(int p, int org, int size) {
+	return ((p - org) % size + size) % size;
+}
+
+static Bool Viv2DGCStipplePattern(GCPtr pGC, int orgx, int orgy, uint32_t *low, uint32_t *high) {
+	PixmapPtr pStipple = pGC->stipple;
+	uint8_t pat[VIV2D_PATTERN_SIZE];
+	int width, height, x, y;
+
+	if (!pStipple)
+		return FALSE;
+
+	width = pStipple->drawable.width;
+	height = pStipple->drawable.height;
+	if (!Viv2DPatternSize(width, height)) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCStipplePattern unsupported stipple size %dx%d", width, height);
+		return FALSE;
+	}
+
+	if (!Viv2DPrepareAccess(pStipple, EXA_PREPARE_SRC))
+		return FALSE;
+
+	for (y = 0; y < VIV2D_PATTERN_SIZE; y++) {
+		const uint8_t *row = (const uint8_t *)pStipple->devPrivate.ptr +
+		                     Viv2DPatternWrap(y, orgy, height) * pStipple->devKind;
+		pat[y] = 0;
+		for (x = 0; x < VIV2D_PATTERN_SIZE; x++) {
+			if (Viv2DBitmapBit(row, Viv2DPatternWrap(x, orgx, width)))
+				pat[y] |= 0x80 >> x;
+		}
+	}
+
+	Viv2DFinishAccess(pStipple, EXA_PREPARE_SRC);
+
+	*low = pat[0] | pat[1] << 8 | pat[2] << 16 | pat[3] << 24;
+	*high = pat[4] | pat[5] << 8 | pat[6] << 16 | (uint32_t)pat[7] << 24;
+
+	return TRUE;
+}
+
+/* replicate the GC tile into a 8x8 color pattern with the GPU, the tile is not read back */
+static Viv2DPixmapPrivPtr Viv2DGCTilePattern(Viv2DPtr v2d, GCPtr pGC, Viv2DPixmapPrivPtr dst, int orgx, int orgy) {
+	PixmapPtr pTile = pGC->tile.pixmap;
+	struct ARMSOCPixmapPrivRec *armsocPix;
+	Viv2DPixmapPrivPtr tile, pat;
+	int width, height, rx, ry, x, y;
+
+	if (pGC->tileIsPixel || !pTile)
+		return NULL;
+
+	width = pTile->drawable.width;
+	height = pTile->drawable.height;
+	if (!Viv2DPatternSize(width, height)) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCTilePattern unsupported tile size %dx%d", width, height);
+		return NULL;
+	}
+
+	// pattern lines are 8 pixels without padding
+	if (dst->format.bpp != 16 && dst->format.bpp != 32)
+		return NULL;
+
+	armsocPix = exaGetPixmapDriverPrivate(pTile);
+	if (!armsocPix || !armsocPix->priv)
+		return NULL;
+
+	tile = armsocPix->priv;
+	if (!tile->bo)
+		return NULL;
+
+	if (!_Viv2DSetFormat(pTile->drawable.depth, pTile->drawable.bitsPerPixel, &tile->format))
+		return NULL;
+
+	pat = calloc(sizeof(*pat), 1);
+	pat->width = VIV2D_PATTERN_SIZE;
+	pat->height = VIV2D_PATTERN_SIZE;
+	pat->pitch = VIV2D_PATTERN_SIZE * dst->format.bpp / 8;
+	pat->format = dst->format;
+	pat->bo = etna_bo_cache_new(v2d->dev, pat->pitch * pat->height, ETNA_BO_WC);
+	if (!pat->bo) {
+		free(pat);
+		return NULL;
+	}
+
+	rx = Viv2DPatternWrap(0, orgx, width);
+	ry = Viv2DPatternWrap(0, orgy, height);
+
+	// at most 9x9 pieces for a 1x1 tile
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES +
+	                    (VIV2D_PATTERN_SIZE + 1) * (VIV2D_PATTERN_SIZE + 1) * (VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(1)) +
+	                    VIV2D_CACHE_FLUSH_RES);
+	_Viv2DStreamSrc(v2d, tile);
+	_Viv2DStreamDst(v2d, pat, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0); // reset blend
+
+	// pattern pixel 0 shows tile pixel rx, the first piece is the tile end
+	for (y = -ry; y < VIV2D_PATTERN_SIZE; y += height) {
+		for (x = -rx; x < VIV2D_PATTERN_SIZE; x += width) {
+			Viv2DRect rect;
+			rect.x1 = max(x, 0);
+			rect.y1 = max(y, 0);
+			rect.x2 = min(x + width, VIV2D_PATTERN_SIZE);
+			rect.y2 = min(y + height, VIV2D_PATTERN_SIZE);
+
+			_Viv2DStreamSrcOrigin(v2d, rect.x1 - x, rect.y1 - y, width, height);
+			_Viv2DStreamRects(v2d, &rect, 1);
+		}
+	}
+	_Viv2DStreamCacheFlush(v2d);
+
+	return pat;
+}
+
+static void Viv2DGCStreamBrushRects(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, Viv2DPixmapPrivPtr pat,
+                                    uint32_t low, uint32_t high, uint32_t fg, uint32_t bg, int rop,
+                                    Viv2DRect *rects, int cur_rect) {
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES +
+	                    VIV2D_SRC_BRUSH_PATTERN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+	_Viv2DStreamEmptySrc(v2d);
+	_Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
+	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, rop, NULL);
+	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0); // reset blend
+	if (pat)
+		_Viv2DStreamBrushPattern(v2d, pat);
+	else
+		_Viv2DStreamBrushMono(v2d, low, high, fg, bg);
+	_Viv2DStreamRects(v2d, rects, cur_rect);
+	_Viv2DStreamCacheFlush(v2d);
+}
+
+static void Viv2DGCStreamFill(Viv2DPtr v2d, GCPtr pGC, Viv2DPixmapPrivPtr dst, Viv2DPixmapPrivPtr pat,
+                              uint32_t low, uint32_t high, uint32_t fg, uint32_t bg,
+                              Viv2DRect *rects, int cur_rect) {
+	switch (pGC->fillStyle) {
+	case FillStippled:
+		// transparent stipple: clear the set pixels then or the foreground in
+		Viv2DGCStreamBrushRects(v2d, dst, NULL, low, high, 0xffffffff, 0, ROP_DST_AND_NOT_PAT, rects, cur_rect);
+		Viv2DGCStreamBrushRects(v2d, dst, NULL, low, high, fg, 0, ROP_PAT_OR_DST, rects, cur_rect);
+		break;
+	case FillOpaqueStippled:
+		Viv2DGCStreamBrushRects(v2d, dst, NULL, low, high, fg, bg, ROP_PAT, rects, cur_rect);
+		break;
+	default:
+		Viv2DGCStreamBrushRects(v2d, dst, pat, 0, 0, 0, 0, ROP_PAT, rects, cur_rect);
+		break;
+	}
+}
+
+static Bool Viv2DDoPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *prect) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+	Viv2DPixmapPrivPtr dst, pat = NULL;
+	Viv2DRect rects[VIV2D_MAX_RECTS];
+	int cur_rect = 0;
+	BoxPtr extents = RegionExtents(pGC->pCompositeClip);
+	uint32_t low = 0, high = 0, fg, bg;
+	int xoff, yoff, orgx, orgy;
+
+	if (!Viv2DGCSolid(pDrawable, pGC, FALSE))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	orgx = pGC->patOrg.x + pDrawable->x + xoff;
+	orgy = pGC->patOrg.y + pDrawable->y + yoff;
+	fg = Viv2DColour(pGC->fgPixel, pDrawable->depth);
+	bg = Viv2DColour(pGC->bgPixel, pDrawable->depth);
+
+	switch (pGC->fillStyle) {
+	case FillTiled:
+		pat = Viv2DGCTilePattern(v2d, pGC, dst, orgx, orgy);
+		if (!pat)
+			return FALSE;
+		break;
+	case FillStippled:
+	case FillOpaqueStippled:
+		if (!Viv2DGCStipplePattern(pGC, orgx, orgy, &low, &high))
+			return FALSE;
+		break;
+	default:
+		return FALSE;
+	}
+
+	_Viv2DOpMarkDst(dst);
+
+	for (; nrect--; prect++) {
+		int nbox = RegionNumRects(pGC->pCompositeClip);
+		BoxPtr pbox = RegionRects(pGC->pCompositeClip);
+		BoxRec box, clip;
+
+		box.x1 = prect->x + pDrawable->x;
+		box.y1 = prect->y + pDrawable->y;
+		box.x2 = box.x1 + prect->width;
+		box.y2 = box.y1 + prect->height;
+
+		if (!Viv2DBoxIntersect(&box, &box, extents))
+			continue;
+
+		for (; nbox--; pbox++) {
+			if (!Viv2DBoxIntersect(&clip, pbox, &box))
+				continue;
+
+			rects[cur_rect].x1 = clip.x1 + xoff;
+			rects[cur_rect].y1 = clip.y1 + yoff;
+			rects[cur_rect].x2 = clip.x2 + xoff;
+			rects[cur_rect].y2 = clip.y2 + yoff;
+			cur_rect++;
+
+			if (cur_rect == VIV2D_MAX_RECTS) {
+				Viv2DGCStreamFill(v2d, pGC, dst, pat, low, high, fg, bg, rects, cur_rect);
+				cur_rect = 0;
+			}
+		}
+	}
+
+	if (cur_rect > 0)
+		Viv2DGCStreamFill(v2d, pGC, dst, pat, low, high, fg, bg, rects, cur_rect);
+
+	VIV2D_DBG_MSG("Viv2DPolyFillRect dst:%p fill:%d rects:%d", dst, pGC->fillStyle, nrect);
+
+	if (pat)
+		_Viv2DOpDelTmpPix(v2d, pat);
+
+	return TRUE;
+}
+
+static void Viv2DPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *prect) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DDoPolyFillRect(pDrawable, pGC, nrect, prect))
+		priv->ops->PolyFillRect(pDrawable, pGC, nrect, prect);
+}
+#endif
+
+#ifdef VIV2D_LINES
+/*
+Zero width lines are drawn by the LINE command, each rect of a DRAW_2D is a
+segment from (x1,y1) to (x2,y2) with the end point excluded, the color comes
+from the solid brush. Zero width line pixels are device dependent in X, only
+the end points must match: when the cap style is not CapNotLast a one pixel
+segment is added for the end point.
+*/
+#define VIV2D_LINE_MAX_COORD 32767
+
+typedef struct {
+	Viv2DRect *segs;
+	int nseg;
+	int size;
+} Viv2DLines;
+
+static inline Bool Viv2DLinesAdd(Viv2DLines *lines, int x1, int y1, int x2, int y2) {
+	Viv2DRect *seg;
+
+	if (min(x1, x2) < 0 || min(y1, y2) < 0 ||
+	        max(x1, x2) >= VIV2D_LINE_MAX_COORD || max(y1, y2) >= VIV2D_LINE_MAX_COORD)
+		return FALSE;
+
+	if (lines->nseg == lines->size) {
+		int size = lines->size ? lines->size * 2 : 64;
+		Viv2DRect *segs = realloc(lines->segs, size * sizeof(*segs));
+		if (!segs)
+			return FALSE;
+		lines->segs = segs;
+		lines->size = size;
+	}
+
+	seg = &lines->segs[lines->nseg++];
+	seg->x1 = x1;
+	seg->y1 = y1;
+	seg->x2 = x2;
+	seg->y2 = y2;
+	return TRUE;
+}
+
+static inline Bool Viv2DLinesAddCap(Viv2DLines *lines, GCPtr pGC, int x, int y) {
+	if (pGC->capStyle == CapNotLast)
+		return TRUE;
+	return Viv2DLinesAdd(lines, x, y, x + 1, y);
+}
+
+static inline Bool Viv2DGCThinLine(DrawablePtr pDrawable, GCPtr pGC) {
+	if (pGC->lineWidth != 0 || pGC->lineStyle != LineSolid) {
+		VIV2D_UNSUPPORTED_MSG("Viv2DGCThinLine unsupported line width:%d style:%d", pGC->lineWidth, pGC->lineStyle);
+		return FALSE;
+	}
+
+	return Viv2DGCSolid(pDrawable, pGC, TRUE);
+}
+
+static void Viv2DGCStreamLineRects(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, Viv2DRect *clip, uint32_t color,
+                                   Viv2DRect *rects, int cur_rect) {
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES +
+	                    VIV2D_SRC_BRUSH_FILL_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+	_Viv2DStreamEmptySrc(v2d);
+	_Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
+	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_LINE, ROP_PAT, clip);
+	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0); // reset blend
+	_Viv2DStreamBrushFill(v2d, color);
+	_Viv2DStreamRects(v2d, rects, cur_rect);
+	_Viv2DStreamCacheFlush(v2d);
+}
+
+/* segments are in pixmap coordinates, the clip region is walked once per batch of segments */
+static void Viv2DGCStreamLines(Viv2DPtr v2d, GCPtr pGC, Viv2DPixmapPrivPtr dst, int xoff, int yoff,
+                               Viv2DLines *lines, uint32_t color) {
+	int nbox = RegionNumRects(pGC->pCompositeClip);
+	BoxPtr pbox = RegionRects(pGC->pCompositeClip);
+
+	for (; nbox--; pbox++) {
+		Viv2DRect rects[VIV2D_MAX_RECTS];
+		int cur_rect = 0;
+		Viv2DRect clip;
+		int i;
+
+		clip.x1 = max(pbox->x1 + xoff, 0);
+		clip.y1 = max(pbox->y1 + yoff, 0);
+		clip.x2 = min(pbox->x2 + xoff, dst->width);
+		clip.y2 = min(pbox->y2 + yoff, dst->height);
+		if (clip.x1 >= clip.x2 || clip.y1 >= clip.y2)
+			continue;
+
+		for (i = 0; i < lines->nseg; i++) {
+			Viv2DRect *seg = &lines->segs[i];
+
+			// segment bounding box outside of this clip box
+			if (max(seg->x1, seg->x2) < clip.x1 || min(seg->x1, seg->x2) >= clip.x2 ||
+			        max(seg->y1, seg->y2) < clip.y1 || min(seg->y1, seg->y2) >= clip.y2)
+				continue;
+
+			rects[cur_rect++] = *seg;
+			if (cur_rect == VIV2D_MAX_RECTS) {
+				Viv2DGCStreamLineRects(v2d, dst, &clip, color, rects, cur_rect);
+				cur_rect = 0;
+			}
+		}
+
+		if (cur_rect > 0)
+			Viv2DGCStreamLineRects(v2d, dst, &clip, color, rects, cur_rect);
+	}
+}
+
+static Bool Viv2DGCDrawLines(DrawablePtr pDrawable, GCPtr pGC, Viv2DPixmapPrivPtr dst, int xoff, int yoff,
+                             Viv2DLines *lines) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+
+	if (lines->nseg > 0) {
+		_Viv2DOpMarkDst(dst);
+		Viv2DGCStreamLines(v2d, pGC, dst, xoff, yoff, lines, Viv2DColour(pGC->fgPixel, pDrawable->depth));
+		VIV2D_DBG_MSG("Viv2DGCDrawLines dst:%p segments:%d", dst, lines->nseg);
+	}
+
+	free(lines->segs);
+	return TRUE;
+}
+
+static Bool Viv2DDoPolylines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt, DDXPointPtr ppt) {
+	Viv2DPixmapPrivPtr dst;
+	Viv2DLines lines = { NULL, 0, 0 };
+	int xoff, yoff, x, y, i;
+
+	if (npt < 2 || !Viv2DGCThinLine(pDrawable, pGC))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	xoff += pDrawable->x;
+	yoff += pDrawable->y;
+
+	x = ppt[0].x;
+	y = ppt[0].y;
+	for (i = 1; i < npt; i++) {
+		int nx = ppt[i].x, ny = ppt[i].y;
+
+		if (mode == CoordModePrevious) {
+			nx += x;
+			ny += y;
+		}
+
+		if (!Viv2DLinesAdd(&lines, x + xoff, y + yoff, nx + xoff, ny + yoff)) {
+			free(lines.segs);
+			return FALSE;
+		}
+		x = nx;
+		y = ny;
+	}
+
+	if (!Viv2DLinesAddCap(&lines, pGC, x + xoff, y + yoff)) {
+		free(lines.segs);
+		return FALSE;
+	}
+
+	// segments are in pixmap coordinates, clip boxes in screen coordinates
+	return Viv2DGCDrawLines(pDrawable, pGC, dst, xoff - pDrawable->x, yoff - pDrawable->y, &lines);
+}
+
+static void Viv2DPolylines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt, DDXPointPtr ppt) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DDoPolylines(pDrawable, pGC, mode, npt, ppt))
+		priv->ops->Polylines(pDrawable, pGC, mode, npt, ppt);
+}
+
+static Bool Viv2DDoPolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg) {
+	Viv2DPixmapPrivPtr dst;
+	Viv2DLines lines = { NULL, 0, 0 };
+	int xoff, yoff, i;
+
+	if (!Viv2DGCThinLine(pDrawable, pGC))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	xoff += pDrawable->x;
+	yoff += pDrawable->y;
+
+	for (i = 0; i < nseg; i++) {
+		if (!Viv2DLinesAdd(&lines, pSeg[i].x1 + xoff, pSeg[i].y1 + yoff, pSeg[i].x2 + xoff, pSeg[i].y2 + yoff) ||
+		        !Viv2DLinesAddCap(&lines, pGC, pSeg[i].x2 + xoff, pSeg[i].y2 + yoff)) {
+			free(lines.segs);
+			return FALSE;
+		}
+	}
+
+	return Viv2DGCDrawLines(pDrawable, pGC, dst, xoff - pDrawable->x, yoff - pDrawable->y, &lines);
+}
+
+static void Viv2DPolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DDoPolySegment(pDrawable, pGC, nseg, pSeg))
+		priv->ops->PolySegment(pDrawable, pGC, nseg, pSeg);
+}
+
+/* zero width rectangle outlines are 4 thin rects, exactly the X pixels */
+static Bool Viv2DDoPolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *pRect) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+	Viv2DPixmapPrivPtr dst;
+	BoxPtr boxes, box;
+	int xoff, yoff, i;
+
+	if (!Viv2DGCThinLine(pDrawable, pGC))
+		return FALSE;
+
+	dst = Viv2DGCDrawablePix(pDrawable, &xoff, &yoff);
+	if (!dst)
+		return FALSE;
+
+	boxes = malloc(nrect * 4 * sizeof(*boxes));
+	if (!boxes)
+		return FALSE;
+
+	box = boxes;
+	for (i = 0; i < nrect; i++) {
+		int x1 = pRect[i].x + pDrawable->x;
+		int y1 = pRect[i].y + pDrawable->y;
+		int x2 = x1 + pRect[i].width;
+		int y2 = y1 + pRect[i].height;
+
+		// top
+		box->x1 = x1; box->y1 = y1; box->x2 = x2 + 1; box->y2 = y1 + 1; box++;
+		if (y2 > y1) {
+			// bottom
+			box->x1 = x1; box->y1 = y2; box->x2 = x2 + 1; box->y2 = y2 + 1; box++;
+			if (y2 > y1 + 1) {
+				// left
+				box->x1 = x1; box->y1 = y1 + 1; box->x2 = x1 + 1; box->y2 = y2; box++;
+				if (x2 > x1) {
+					// right
+					box->x1 = x2; box->y1 = y1 + 1; box->x2 = x2 + 1; box->y2 = y2; box++;
+				}
+			}
+		}
+	}
+
+	_Viv2DOpMarkDst(dst);
+	Viv2DGCFillBoxes(v2d, pGC, dst, xoff, yoff, boxes, box - boxes, Viv2DColour(pGC->fgPixel, pDrawable->depth));
+
+	VIV2D_DBG_MSG("Viv2DPolyRectangle dst:%p rects:%d", dst, nrect);
+
+	free(boxes);
+	return TRUE;
+}
+
+static void Viv2DPolyRectangle(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *pRect) {
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+
+	if (!Viv2DDoPolyRectangle(pDrawable, pGC, nrect, pRect))
+		priv->ops->PolyRectangle(pDrawable, pGC, nrect, pRect);
+}
+#endif
+
+static void Viv2DGCSetupOps(GCPtr pGC, Viv2DGCPrivPtr priv) {
+	priv->ops = pGC->ops;
+	priv->accel_ops = *pGC->ops;
+
+#ifdef VIV2D_SUPPORT_MONO
+	priv->accel_ops.ImageGlyphBlt = Viv2DImageGlyphBlt;
+	priv->accel_ops.PolyGlyphBlt = Viv2DPolyGlyphBlt;
+	priv->accel_ops.PushPixels = Viv2DPushPixels;
+#endif
+#ifdef VIV2D_LINES
+	if (pGC->lineWidth == 0 && pGC->lineStyle == LineSolid) {
+		priv->accel_ops.Polylines = Viv2DPolylines;
+		priv->accel_ops.PolySegment = Viv2DPolySegment;
+		priv->accel_ops.PolyRectangle = Viv2DPolyRectangle;
+	}
+#endif
+#ifdef VIV2D_FILL_PATTERN
+	// solid fills are already done by EXA
+	if (pGC->fillStyle != FillSolid)
+		priv->accel_ops.PolyFillRect = Viv2DPolyFillRect;
+#endif
+
+	pGC->ops = &priv->accel_ops;
+}
+
+// GC funcs wrappers
+
+static const GCFuncs viv2d_gc_funcs;
+
+#define VIV2D_GC_FUNC_PROLOGUE(pGC) \
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC); \
+	(pGC)->funcs = priv->funcs; \
+	if (priv->ops) \
+		(pGC)->ops = priv->ops
+
+#define VIV2D_GC_FUNC_EPILOGUE(pGC) \
+	priv->funcs = (pGC)->funcs; \
+	(pGC)->funcs = &viv2d_gc_funcs; \
+	if (priv->ops) \
+		Viv2DGCSetupOps(pGC, priv)
+
+static void Viv2DValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->ValidateGC(pGC, changes, pDrawable);
+	priv->funcs = pGC->funcs;
+	pGC->funcs = &viv2d_gc_funcs;
+	Viv2DGCSetupOps(pGC, priv);
+}
+
+static void Viv2DChangeGC(GCPtr pGC, unsigned long mask) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->ChangeGC(pGC, mask);
+	VIV2D_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void Viv2DCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGC) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->CopyGC(pGCSrc, mask, pGC);
+	VIV2D_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void Viv2DDestroyGC(GCPtr pGC) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->DestroyGC(pGC);
+	priv->ops = NULL;
+}
+
+static void Viv2DChangeClip(GCPtr pGC, int type, void *pvalue, int nrects) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->ChangeClip(pGC, type, pvalue, nrects);
+	VIV2D_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void Viv2DCopyClip(GCPtr pGCDst, GCPtr pGCSrc) {
+	GCPtr pGC = pGCDst;
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->CopyClip(pGCDst, pGCSrc);
+	VIV2D_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void Viv2DDestroyClip(GCPtr pGC) {
+	VIV2D_GC_FUNC_PROLOGUE(pGC);
+	pGC->funcs->DestroyClip(pGC);
+	VIV2D_GC_FUNC_EPILOGUE(pGC);
+}
+
+static const GCFuncs viv2d_gc_funcs = {
+	Viv2DValidateGC,
+	Viv2DChangeGC,
+	Viv2DCopyGC,
+	Viv2DDestroyGC,
+	Viv2DChangeClip,
+	Viv2DDestroyClip,
+	Viv2DCopyClip,
+};
+
+static Bool Viv2DCreateGC(GCPtr pGC) {
+	ScreenPtr pScreen = pGC->pScreen;
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	Viv2DGCPrivPtr priv = Viv2DGCPriv(pGC);
+	Bool ret;
+
+	pScreen->CreateGC = v2d->CreateGC;
+	ret = pScreen->CreateGC(pGC);
+	if (ret) {
+		priv->funcs = pGC->funcs;
+		priv->ops = NULL; // ops are wrapped at ValidateGC
+		pGC->funcs = &viv2d_gc_funcs;
+	}
+	v2d->CreateGC = pScreen->CreateGC;
+	pScreen->CreateGC = Viv2DCreateGC;
+
+	return ret;
+}
+
+/* must be called after exaDriverInit, wraps EXA CreateGC */
+Bool Viv2DGCScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+
+	if (!dixRegisterPrivateKey(&viv2d_gc_key, PRIVATE_GC, sizeof(Viv2DGCPrivRec)))
+		return FALSE;
+
+	v2d->CreateGC = pScreen->CreateGC;
+	pScreen->CreateGC = Viv2DCreateGC;
+
+	return TRUE;
+}
+
+void Viv2DGCScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+
+	if (v2d->CreateGC && pScreen->CreateGC == Viv2DCreateGC)
+		pScreen->CreateGC = v2d->CreateGC;
+	v2d->CreateGC = NULL;
+}
+#endif
@@ -0,0 +1,413 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "privates.h"
+#include "picturestr.h"
+#include "glyphstr.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_GLYPH_ATLAS
+
+/*
+EXA draws a glyph string by accumulating the glyphs in a mask pixmap then
+compositing the source through that mask, a three pass masked composite with
+a tmp bo on this GPU. Glyphs is wrapped: with a solid source and glyphs that
+do not overlap, the mask is not needed and each glyph is composited straight
+from an atlas pixmap, one A8 and one ARGB, holding glyphs in fixed size cells.
+All the composites of a string share their pictures, so DoneComposite keeps
+the states open and the glyphs go to the GPU as one rect batch. Cells are
+evicted least recently used first, never while the string being drawn uses
+them, and freed when the glyph is unrealized.
+*/
+
+#define VIV2D_GLYPH_CELL 32 // larger glyphs go through EXA
+#define VIV2D_GLYPH_ATLAS_WIDTH 1024
+#define VIV2D_GLYPH_ATLAS_HEIGHT 512
+#define VIV2D_GLYPH_ATLASES 2 // A8, ARGB
+
+typedef struct {
+	unsigned short cell[VIV2D_GLYPH_ATLASES]; // cell + 1, 0 if not in the atlas
+} Viv2DGlyphPriv;
+
+typedef struct {
+	PicturePtr pict;
+	PicturePtr pict_ca; // same pixmap with component alpha, ARGB only
+	GlyphPtr *cells;
+	unsigned int *stamps; // last use of each cell, 0 if free
+	int count;
+} Viv2DGlyphAtlas;
+
+typedef struct _Viv2DGlyphCache {
+	GlyphsProcPtr Glyphs;
+	UnrealizeGlyphProcPtr UnrealizeGlyph;
+	Viv2DGlyphAtlas atlas[VIV2D_GLYPH_ATLASES];
+	unsigned int stamp; // one per string
+} Viv2DGlyphCache;
+
+static DevPrivateKeyRec viv2d_glyph_key;
+
+static inline Viv2DGlyphPriv *Viv2DGlyphGetPriv(GlyphPtr glyph) {
+	return dixGetPrivateAddr(&glyph->devPrivates, &viv2d_glyph_key);
+}
+
+static inline int Viv2DGlyphAtlasIndex(PictFormatShort format) {
+	switch (format) {
+	case PICT_a8:
+		return 0;
+	case PICT_a8r8g8b8:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+static inline Bool Viv2DGlyphSolidSource(PicturePtr pSrc) {
+	if (!pSrc->pDrawable)
+		return pSrc->pSourcePict && pSrc->pSourcePict->type == SourcePictTypeSolidFill;
+
+	return pSrc->pDrawable->width == 1 && pSrc->pDrawable->height == 1 &&
+	       pSrc->repeat && !pSrc->transform;
+}
+
+static void Viv2DGlyphAtlasFree(Viv2DGlyphAtlas *atlas, int index) {
+	int i;
+
+	if (atlas->cells) {
+		for (i = 0; i < atlas->count; i++)
+			if (atlas->cells[i])
+				Viv2DGlyphGetPriv(atlas->cells[i])->cell[index] = 0;
+	}
+	if (atlas->pict)
+		FreePicture(atlas->pict, 0);
+	if (atlas->pict_ca)
+		FreePicture(atlas->pict_ca, 0);
+	free(atlas->cells);
+	free(atlas->stamps);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+/* atlases are only created once text is drawn with them */
+static Bool Viv2DGlyphAtlasInit(ScreenPtr pScreen, Viv2DGlyphAtlas *atlas, int index) {
+	int depth = index ? 32 : 8;
+	PictFormatPtr pFormat;
+	PixmapPtr pPixmap;
+	XID ca = xTrue;
+	int error;
+
+	if (atlas->pict)
+		return TRUE;
+
+	pFormat = PictureMatchFormat(pScreen, depth, index ? PICT_a8r8g8b8 : PICT_a8);
+	if (!pFormat)
+		return FALSE;
+
+	pPixmap = pScreen->CreatePixmap(pScreen, VIV2D_GLYPH_ATLAS_WIDTH, VIV2D_GLYPH_ATLAS_HEIGHT, depth, 0);
+	if (!pPixmap)
+		return FALSE;
+
+	// the pictures hold a ref
+	atlas->pict = CreatePicture(0, &pPixmap->drawable, pFormat, 0, NULL, serverClient, &error);
+	if (index)
+		atlas->pict_ca = CreatePicture(0, &pPixmap->drawable, pFormat, CPComponentAlpha, &ca, serverClient, &error);
+	pScreen->DestroyPixmap(pPixmap);
+
+	atlas->count = (VIV2D_GLYPH_ATLAS_WIDTH / VIV2D_GLYPH_CELL) * (VIV2D_GLYPH_ATLAS_HEIGHT / VIV2D_GLYPH_CELL);
+	atlas->cells = calloc(atlas->count, sizeof(*atlas->cells));
+	atlas->stamps = calloc(atlas->count, sizeof(*atlas->stamps));
+
+	if (!atlas->pict || (index && !atlas->pict_ca) || !atlas->cells || !atlas->stamps) {
+		Viv2DGlyphAtlasFree(atlas, index);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static inline void Viv2DGlyphCellPos(int cell, int *x, int *y) {
+	*x = (cell % (VIV2D_GLYPH_ATLAS_WIDTH / VIV2D_GLYPH_CELL)) * VIV2D_GLYPH_CELL;
+	*y = (cell / (VIV2D_GLYPH_ATLAS_WIDTH / VIV2D_GLYPH_CELL)) * VIV2D_GLYPH_CELL;
+}
+
+/* cell of the glyph, uploaded on a miss; -1 if the string uses every cell */
+static int Viv2DGlyphCell(Viv2DGlyphCache *cache, int index, GlyphPtr glyph, PicturePtr pGlyph) {
+	Viv2DGlyphAtlas *atlas = &cache->atlas[index];
+	Viv2DGlyphPriv *priv = Viv2DGlyphGetPriv(glyph);
+	int cell = priv->cell[index] - 1;
+	int i, x, y;
+
+	if (cell >= 0) {
+		atlas->stamps[cell] = cache->stamp;
+		return cell;
+	}
+
+	cell = 0;
+	for (i = 1; i < atlas->count && atlas->stamps[cell]; i++) {
+		if (atlas->stamps[i] < atlas->stamps[cell])
+			cell = i;
+	}
+
+	if (atlas->stamps[cell] == cache->stamp)
+		return -1;
+
+	if (atlas->cells[cell])
+		Viv2DGlyphGetPriv(atlas->cells[cell])->cell[index] = 0;
+
+	atlas->cells[cell] = glyph;
+	atlas->stamps[cell] = cache->stamp;
+	priv->cell[index] = cell + 1;
+
+	Viv2DGlyphCellPos(cell, &x, &y);
+	CompositePicture(PictOpSrc, pGlyph, NULL, atlas->pict, 0, 0, 0, 0, x, y,
+	                 glyph->info.width, glyph->info.height);
+
+	return cell;
+}
+
+/*
+ * check the string can be drawn from the atlas : glyphs of a single atlas
+ * format, small enough for a cell and, when a mask is asked for, not
+ * overlapping and of the mask format. Returns the atlas index or -1.
+ */
+static int Viv2DGlyphsCheck(ScreenPtr pScreen, PictFormatPtr maskFormat, Bool *ca,
+                            int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+	RegionRec drawn;
+	int index = -1;
+	int x = 0, y = 0;
+	int n;
+
+	RegionNull(&drawn);
+
+	while (nlist--) {
+		x += list->xOff;
+		y += list->yOff;
+		n = list->len;
+		while (n--) {
+			GlyphPtr glyph = *glyphs++;
+
+			if (glyph->info.width > 0 && glyph->info.height > 0) {
+				PicturePtr pGlyph = GlyphPicture(glyph)[pScreen->myNum];
+				int i = Viv2DGlyphAtlasIndex(pGlyph->format);
+
+				if (i < 0 || (index >= 0 && i != index) ||
+				        glyph->info.width > VIV2D_GLYPH_CELL || glyph->info.height > VIV2D_GLYPH_CELL)
+					goto fail;
+
+				if (maskFormat) {
+					BoxRec box;
+
+					if (maskFormat->format != pGlyph->format)
+						goto fail;
+
+					box.x1 = x - glyph->info.x;
+					box.y1 = y - glyph->info.y;
+					box.x2 = box.x1 + glyph->info.width;
+					box.y2 = box.y1 + glyph->info.height;
+
+					if (RegionContainsRect(&drawn, &box) != rgnOUT)
+						goto fail;
+					RegionUnionRect(&drawn, &box);
+					// miGlyphs gives an ARGB mask component alpha
+					*ca = i != 0;
+				} else {
+					if (index >= 0 && *ca != pGlyph->componentAlpha)
+						goto fail;
+					*ca = pGlyph->componentAlpha;
+				}
+				index = i;
+			}
+			x += glyph->info.xOff;
+			y += glyph->info.yOff;
+		}
+		list++;
+	}
+
+	RegionUninit(&drawn);
+	return index;
+
+fail:
+	RegionUninit(&drawn);
+	return -1;
+}
+
+static Bool Viv2DGlyphsDraw(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                            INT16 xSrc, INT16 ySrc, int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	Viv2DGlyphCache *cache = Viv2DPrivFromScreen(pScreen)->glyphs;
+	Viv2DGlyphAtlas *atlas;
+	PicturePtr pMask;
+	GlyphListPtr l;
+	GlyphPtr *g;
+	Bool ca = FALSE;
+	int index, nl, n, x, y, xDst, yDst;
+
+	if (!Viv2DGlyphSolidSource(pSrc))
+		return FALSE;
+
+	// with a mask, pixels between the glyphs are composited with a zero mask
+	if (maskFormat && !Viv2DOpKeepsDst(op))
+		return FALSE;
+
+	index = Viv2DGlyphsCheck(pScreen, maskFormat, &ca, nlist, list, glyphs);
+	if (index < 0)
+		return FALSE;
+
+	atlas = &cache->atlas[index];
+	if (!Viv2DGlyphAtlasInit(pScreen, atlas, index))
+		return FALSE;
+
+	// upload the missing glyphs first, so the draws follow each other
+	cache->stamp++;
+	for (l = list, g = glyphs, nl = nlist; nl--; l++) {
+		for (n = l->len; n--; g++) {
+			if ((*g)->info.width > 0 && (*g)->info.height > 0 &&
+			        Viv2DGlyphCell(cache, index, *g, GlyphPicture(*g)[pScreen->myNum]) < 0)
+				return FALSE;
+		}
+	}
+
+	pMask = ca ? atlas->pict_ca : atlas->pict;
+	xDst = list->xOff;
+	yDst = list->yOff;
+	x = 0;
+	y = 0;
+	for (l = list, g = glyphs, nl = nlist; nl--; l++) {
+		x += l->xOff;
+		y += l->yOff;
+		for (n = l->len; n--; g++) {
+			GlyphPtr glyph = *g;
+
+			if (glyph->info.width > 0 && glyph->info.height > 0) {
+				int gx = x - glyph->info.x;
+				int gy = y - glyph->info.y;
+				int cx, cy;
+
+				Viv2DGlyphCellPos(Viv2DGlyphGetPriv(glyph)->cell[index] - 1, &cx, &cy);
+				CompositePicture(op, pSrc, pMask, pDst,
+				                 xSrc + gx - xDst, ySrc + gy - yDst, cx, cy, gx, gy,
+				                 glyph->info.width, glyph->info.height);
+			}
+			x += glyph->info.xOff;
+			y += glyph->info.yOff;
+		}
+	}
+
+	return TRUE;
+}
+
+static void Viv2DGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                        INT16 xSrc, INT16 ySrc, int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	Viv2DGlyphCache *cache = Viv2DPrivFromScreen(pScreen)->glyphs;
+
+	if (Viv2DGlyphsDraw(op, pSrc, pDst, maskFormat, xSrc, ySrc, nlist, list, glyphs))
+		return;
+
+	ps->Glyphs = cache->Glyphs;
+	ps->Glyphs(op, pSrc, pDst, maskFormat, xSrc, ySrc, nlist, list, glyphs);
+	cache->Glyphs = ps->Glyphs;
+	ps->Glyphs = Viv2DGlyphs;
+}
+
+static void Viv2DGlyphUnrealize(ScreenPtr pScreen, GlyphPtr glyph) {
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	Viv2DGlyphCache *cache = Viv2DPrivFromScreen(pScreen)->glyphs;
+	Viv2DGlyphPriv *priv = Viv2DGlyphGetPriv(glyph);
+	int i;
+
+	for (i = 0; i < VIV2D_GLYPH_ATLASES; i++) {
+		if (priv->cell[i]) {
+			cache->atlas[i].cells[priv->cell[i] - 1] = NULL;
+			cache->atlas[i].stamps[priv->cell[i] - 1] = 0;
+			priv->cell[i] = 0;
+		}
+	}
+
+	ps->UnrealizeGlyph = cache->UnrealizeGlyph;
+	ps->UnrealizeGlyph(pScreen, glyph);
+	cache->UnrealizeGlyph = ps->UnrealizeGlyph;
+	ps->UnrealizeGlyph = Viv2DGlyphUnrealize;
+}
+
+Bool Viv2DGlyphScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+	if (!ps)
+		return TRUE;
+
+	if (!dixRegisterPrivateKey(&viv2d_glyph_key, PRIVATE_GLYPH, sizeof(Viv2DGlyphPriv)))
+		return FALSE;
+
+	v2d->glyphs = calloc(1, sizeof(*v2d->glyphs));
+	if (!v2d->glyphs)
+		return FALSE;
+
+	v2d->glyphs->Glyphs = ps->Glyphs;
+	ps->Glyphs = Viv2DGlyphs;
+	v2d->glyphs->UnrealizeGlyph = ps->UnrealizeGlyph;
+	ps->UnrealizeGlyph = Viv2DGlyphUnrealize;
+
+	return TRUE;
+}
+
+void Viv2DGlyphScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	Viv2DGlyphCache *cache = v2d->glyphs;
+	int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < VIV2D_GLYPH_ATLASES; i++)
+		Viv2DGlyphAtlasFree(&cache->atlas[i], i);
+
+	if (ps && ps->Glyphs == Viv2DGlyphs)
+		ps->Glyphs = cache->Glyphs;
+	if (ps && ps->UnrealizeGlyph == Viv2DGlyphUnrealize)
+		ps->UnrealizeGlyph = cache->UnrealizeGlyph;
+
+	free(cache);
+	v2d->glyphs = NULL;
+}
+#endif
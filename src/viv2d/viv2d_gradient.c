@@ -0,0 +1,335 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "picturestr.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_GRADIENT_CACHE
+
+/*
+The GC320 cannot generate gradients, Viv2DCheckComposite rejects them and the
+composite falls back to pixman. Toolkits redraw the same gradients again and
+again, so Composite is wrapped: the part of the gradient used is rendered once
+into an ARGB pixmap with the fallback, then the composite is done from that
+pixmap, which is accelerated. Gradient source pictures cannot be changed after
+creation, entries are keyed by content and only evicted by LRU.
+*/
+
+#define VIV2D_GRADIENT_CACHE_SIZE 32
+#define VIV2D_GRADIENT_MAX_PIXELS (512 * 512)
+
+typedef struct {
+	PicturePtr pPicture; // rasterised gradient, NULL if unused
+	unsigned int stamp; // last use
+
+	// key
+	unsigned int type;
+	union {
+		struct {
+			xPointFixed p1, p2;
+		} linear;
+		struct {
+			PictCircle c1, c2;
+		} radial;
+		struct {
+			xPointFixed center;
+			xFixed angle;
+		} conical;
+	} geom;
+	int nstops;
+	PictGradientStopPtr stops;
+	Bool has_transform;
+	PictTransform transform;
+	unsigned int repeat_type;
+	int filter;
+	int x, y, width, height;
+} Viv2DGradientEntry;
+
+typedef struct _Viv2DGradientCache {
+	Viv2DGradientEntry entries[VIV2D_GRADIENT_CACHE_SIZE];
+	unsigned int stamp;
+} Viv2DGradientCache;
+
+static inline Bool Viv2DIsGradient(PicturePtr pPicture) {
+	if (pPicture->pDrawable || !pPicture->pSourcePict)
+		return FALSE;
+
+	switch (pPicture->pSourcePict->type) {
+	case SourcePictTypeLinear:
+	case SourcePictTypeRadial:
+	case SourcePictTypeConical:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void Viv2DGradientEntryFree(Viv2DGradientEntry *entry) {
+	if (entry->pPicture)
+		FreePicture(entry->pPicture, 0);
+	free(entry->stops);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static Bool Viv2DGradientEntryMatch(Viv2DGradientEntry *entry, PicturePtr pPicture,
+                                    int x, int y, int width, int height) {
+	SourcePictPtr sp = pPicture->pSourcePict;
+
+	if (!entry->pPicture || entry->type != sp->type)
+		return FALSE;
+
+	if (entry->x != x || entry->y != y || entry->width != width || entry->height != height)
+		return FALSE;
+
+	if (entry->repeat_type != pPicture->repeatType || entry->filter != pPicture->filter)
+		return FALSE;
+
+	switch (sp->type) {
+	case SourcePictTypeLinear:
+		if (memcmp(&entry->geom.linear.p1, &sp->linear.p1, sizeof(xPointFixed)) ||
+		        memcmp(&entry->geom.linear.p2, &sp->linear.p2, sizeof(xPointFixed)))
+			return FALSE;
+		break;
+	case SourcePictTypeRadial:
+		if (memcmp(&entry->geom.radial.c1, &sp->radial.c1, sizeof(PictCircle)) ||
+		        memcmp(&entry->geom.radial.c2, &sp->radial.c2, sizeof(PictCircle)))
+			return FALSE;
+		break;
+	case SourcePictTypeConical:
+		if (memcmp(&entry->geom.conical.center, &sp->conical.center, sizeof(xPointFixed)) ||
+		        entry->geom.conical.angle != sp->conical.angle)
+			return FALSE;
+		break;
+	}
+
+	if (entry->nstops != sp->gradient.nstops ||
+	        memcmp(entry->stops, sp->gradient.stops, sp->gradient.nstops * sizeof(PictGradientStop)))
+		return FALSE;
+
+	if (entry->has_transform != (pPicture->transform != NULL))
+		return FALSE;
+	if (pPicture->transform && memcmp(&entry->transform, pPicture->transform, sizeof(PictTransform)))
+		return FALSE;
+
+	return TRUE;
+}
+
+static Bool Viv2DGradientEntrySetKey(Viv2DGradientEntry *entry, PicturePtr pPicture,
+                                     int x, int y, int width, int height) {
+	SourcePictPtr sp = pPicture->pSourcePict;
+
+	entry->stops = malloc(sp->gradient.nstops * sizeof(PictGradientStop));
+	if (!entry->stops)
+		return FALSE;
+	memcpy(entry->stops, sp->gradient.stops, sp->gradient.nstops * sizeof(PictGradientStop));
+	entry->nstops = sp->gradient.nstops;
+
+	entry->type = sp->type;
+	switch (sp->type) {
+	case SourcePictTypeLinear:
+		entry->geom.linear.p1 = sp->linear.p1;
+		entry->geom.linear.p2 = sp->linear.p2;
+		break;
+	case SourcePictTypeRadial:
+		entry->geom.radial.c1 = sp->radial.c1;
+		entry->geom.radial.c2 = sp->radial.c2;
+		break;
+	case SourcePictTypeConical:
+		entry->geom.conical.center = sp->conical.center;
+		entry->geom.conical.angle = sp->conical.angle;
+		break;
+	}
+
+	entry->has_transform = pPicture->transform != NULL;
+	if (pPicture->transform)
+		entry->transform = *pPicture->transform;
+	entry->repeat_type = pPicture->repeatType;
+	entry->filter = pPicture->filter;
+	entry->x = x;
+	entry->y = y;
+	entry->width = width;
+	entry->height = height;
+
+	return TRUE;
+}
+
+/* render width x height of the gradient from x,y into a new ARGB picture */
+static PicturePtr Viv2DGradientRasterise(ScreenPtr pScreen, PicturePtr pGradient,
+        int x, int y, int width, int height) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PictFormatPtr pFormat;
+	PixmapPtr pPixmap;
+	PicturePtr pPicture;
+	int error;
+
+	pFormat = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+	if (!pFormat)
+		return NULL;
+
+	pPixmap = pScreen->CreatePixmap(pScreen, width, height, 32, 0);
+	if (!pPixmap)
+		return NULL;
+
+	pPicture = CreatePicture(0, &pPixmap->drawable, pFormat, 0, NULL, serverClient, &error);
+	// the picture holds a ref
+	pScreen->DestroyPixmap(pPixmap);
+	if (!pPicture)
+		return NULL;
+
+	// software fallback, only this once
+	v2d->Composite(PictOpSrc, pGradient, NULL, pPicture, x, y, 0, 0, 0, 0, width, height);
+
+	return pPicture;
+}
+
+static PicturePtr Viv2DGradientLookup(ScreenPtr pScreen, Viv2DGradientCache *cache, PicturePtr pGradient,
+                                      int x, int y, int width, int height) {
+	Viv2DGradientEntry *entry = NULL;
+	int i;
+
+	if (width <= 0 || height <= 0 || width * height > VIV2D_GRADIENT_MAX_PIXELS)
+		return NULL;
+
+	cache->stamp++;
+
+	for (i = 0; i < VIV2D_GRADIENT_CACHE_SIZE; i++) {
+		if (Viv2DGradientEntryMatch(&cache->entries[i], pGradient, x, y, width, height)) {
+			cache->entries[i].stamp = cache->stamp;
+			return cache->entries[i].pPicture;
+		}
+	}
+
+	// miss, replace the least recently used entry
+	for (i = 0; i < VIV2D_GRADIENT_CACHE_SIZE; i++) {
+		if (!cache->entries[i].pPicture) {
+			entry = &cache->entries[i];
+			break;
+		}
+		if (!entry || cache->entries[i].stamp < entry->stamp)
+			entry = &cache->entries[i];
+	}
+
+	Viv2DGradientEntryFree(entry);
+
+	if (!Viv2DGradientEntrySetKey(entry, pGradient, x, y, width, height))
+		return NULL;
+
+	entry->pPicture = Viv2DGradientRasterise(pScreen, pGradient, x, y, width, height);
+	if (!entry->pPicture) {
+		Viv2DGradientEntryFree(entry);
+		return NULL;
+	}
+	entry->stamp = cache->stamp;
+
+	VIV2D_DBG_MSG("Viv2DGradientLookup new entry %p type:%d stops:%d %dx%d:%dx%d",
+	              entry, entry->type, entry->nstops, x, y, width, height);
+
+	return entry->pPicture;
+}
+
+static void
+Viv2DGradientComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
+                       INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                       INT16 xDst, INT16 yDst, CARD16 width, CARD16 height) {
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PicturePtr pCached;
+
+	if (Viv2DIsGradient(pSrc)) {
+		pCached = Viv2DGradientLookup(pScreen, v2d->gradients, pSrc, xSrc, ySrc, width, height);
+		if (pCached) {
+			pSrc = pCached;
+			xSrc = 0;
+			ySrc = 0;
+		}
+	}
+
+	if (pMask && !pMask->componentAlpha && Viv2DIsGradient(pMask)) {
+		pCached = Viv2DGradientLookup(pScreen, v2d->gradients, pMask, xMask, yMask, width, height);
+		if (pCached) {
+			pMask = pCached;
+			xMask = 0;
+			yMask = 0;
+		}
+	}
+
+	ps->Composite = v2d->Composite;
+	ps->Composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask, xDst, yDst, width, height);
+	v2d->Composite = ps->Composite;
+	ps->Composite = Viv2DGradientComposite;
+}
+
+Bool Viv2DGradientScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+	if (!ps)
+		return TRUE;
+
+	v2d->gradients = calloc(1, sizeof(*v2d->gradients));
+	if (!v2d->gradients)
+		return FALSE;
+
+	v2d->Composite = ps->Composite;
+	ps->Composite = Viv2DGradientComposite;
+
+	return TRUE;
+}
+
+void Viv2DGradientScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	int i;
+
+	if (v2d->gradients) {
+		for (i = 0; i < VIV2D_GRADIENT_CACHE_SIZE; i++)
+			Viv2DGradientEntryFree(&v2d->gradients->entries[i]);
+		free(v2d->gradients);
+		v2d->gradients = NULL;
+	}
+
+	if (ps && v2d->Composite && ps->Composite == Viv2DGradientComposite)
+		ps->Composite = v2d->Composite;
+	v2d->Composite = NULL;
+}
+#endif
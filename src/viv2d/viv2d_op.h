@@ -34,17 +34,23 @@ static inline void etna_set_state(struct etna_cmd_stream *stream, uint32_t addre
 	etna_cmd_stream_emit(stream, value);
 }
 
-static inline void etna_set_state_from_bo(struct etna_cmd_stream *stream,
-        uint32_t address, struct etna_bo *bo, int flags)
+static inline void etna_set_state_from_bo_offset(struct etna_cmd_stream *stream,
+        uint32_t address, struct etna_bo *bo, uint32_t offset, int flags)
 {
 	etna_emit_load_state(stream, address >> 2, 1);
 	etna_cmd_stream_reloc(stream, &(struct etna_reloc) {
 		.bo = bo,
 		 .flags = flags,
-		  .offset = 0,
+		  .offset = offset,
 	});
 }
 
+static inline void etna_set_state_from_bo(struct etna_cmd_stream *stream,
+        uint32_t address, struct etna_bo *bo, int flags)
+{
+	etna_set_state_from_bo_offset(stream, address, bo, 0, flags);
+}
+
 static inline void etna_set_state_multi(struct etna_cmd_stream *stream, uint32_t base, uint32_t num, const uint32_t *values)
 {
 	int i;
@@ -75,9 +81,11 @@ static inline void etna_add_state(struct etna_cmd_stream *stream, uint32_t value
 
 #define VIV2D_SRC_RES 6
 #define VIV2D_SRC_EMPTY_RES 4
+#define VIV2D_SRC_MONO_RES 10
 #define VIV2D_SRC_ORIGIN_RES 4
 #define VIV2D_SRC_SOLID_RES 2
 #define VIV2D_SRC_BRUSH_FILL_RES 8
+#define VIV2D_SRC_BRUSH_PATTERN_RES 10
 #define VIV2D_SRC_STRETCH_RES 4
 #define VIV2D_DEST_RES 10
 #define VIV2D_BLEND_ON_RES 8
@@ -88,6 +96,8 @@ static inline void etna_add_state(struct etna_cmd_stream *stream, uint32_t value
 #define VIV2D_CACHE_FLUSH_RES 0
 #endif
 #define VIV2D_RECTS_RES(cnt) cnt*2+2
+#define VIV2D_MULTI_SRC_RES 24
+#define VIV2D_MULTI_SOURCE_RES 2
 
 static inline Bool _Viv2DSetFormat(unsigned int depth, unsigned int bpp, Viv2DFormat *fmt)
 {
@@ -132,9 +142,21 @@ static inline void _Viv2DOpAddRect(Viv2DOp *op, int x, int y, int width, int hei
 	op->cur_rect++;
 }
 
+/* pix is about to be written by the GPU */
+static inline void _Viv2DOpMarkDst(Viv2DPixmapPrivPtr pix) {
+	pix->refcnt++;
+	pix->has_color = FALSE;
+#ifdef VIV2D_CACHED_PIXMAPS
+	if (pix->cpu_score > -VIV2D_CACHED_SCORE)
+		pix->cpu_score--;
+#endif
+}
+
 static inline void _Viv2DOpInit(Viv2DOp *op) {
 	op->has_mask = FALSE;
 	op->has_component_alpha = FALSE;
+	op->solid_msk = FALSE;
+	op->split = FALSE;
 	op->blend_op = NULL;
 	op->prev_src_x = -1;
 	op->prev_src_y = -1;
@@ -172,7 +194,14 @@ static inline int _Viv2DStreamWait(Viv2DPtr v2d) {
 //	VIV2D_DBG_MSG("_Viv2DStreamCommit pipe wait end");
 }
 
+#ifdef VIV2D_COMPOSITE_BATCH
+static inline void _Viv2DOpFlushPending(Viv2DPtr v2d);
+#endif
+
 static inline void _Viv2DStreamCommit(Viv2DPtr v2d, Bool async) {
+#ifdef VIV2D_COMPOSITE_BATCH
+	_Viv2DOpFlushPending(v2d);
+#endif
 //	VIV2D_DBG_MSG("_Viv2DStreamCommit %d %d (%d)", async, etna_cmd_stream_avail(v2d->stream), v2d->stream->offset);
 	if (etna_cmd_stream_offset(v2d->stream) > 0) {
 		VIV2D_DBG_MSG("_Viv2DStreamCommit flush start %d (%d)", etna_cmd_stream_avail(v2d->stream), v2d->stream->offset);
@@ -188,12 +217,65 @@ static inline void _Viv2DStreamCommit(Viv2DPtr v2d, Bool async) {
 
 static inline void _Viv2DStreamReserve(Viv2DPtr v2d, size_t n)
 {
+#ifdef VIV2D_COMPOSITE_BATCH
+	// anything streamed after a kept open composite closes it
+	_Viv2DOpFlushPending(v2d);
+#endif
 	if (etna_cmd_stream_avail(v2d->stream) < n) {
 		VIV2D_OP_DBG_MSG("_Viv2DStreamReserve %d < %d (%d)", etna_cmd_stream_avail(v2d->stream), n, v2d->stream->offset);
 		etna_cmd_stream_flush(v2d->stream);
 	}
 }
 
+/* submit with an out fence, a sync_file signalled when everything queued is done */
+static inline int _Viv2DStreamCommitFence(Viv2DPtr v2d) {
+	int fd = -1;
+
+#ifdef VIV2D_COMPOSITE_BATCH
+	_Viv2DOpFlushPending(v2d);
+#endif
+	// never an empty submit, the fence must follow the last one
+	if (etna_cmd_stream_offset(v2d->stream) == 0) {
+		_Viv2DStreamReserve(v2d, 2);
+		etna_set_state(v2d->stream, VIVS_GL_FLUSH_CACHE, VIVS_GL_FLUSH_CACHE_PE2D);
+	}
+	etna_cmd_stream_flush2(v2d->stream, -1, &fd);
+	return fd;
+}
+
+/*
+ * the client writes and reads its memory behind the engine: clean the CPU
+ * cache the first time the stream uses it, the flush callback waits for the
+ * engine and invalidates it before the client gets any reply or event.
+ */
+static inline void _Viv2DStreamUsermem(Viv2DPtr v2d, Viv2DPixmapPrivPtr pix) {
+	Viv2DUsermemSet *set = &v2d->usermem;
+	int i;
+
+	if (!pix->usermem)
+		return;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->bo[i] == pix->bo)
+			return;
+	}
+
+	if (set->count == set->size) {
+		int size = set->size ? set->size * 2 : 8;
+		struct etna_bo **bo = realloc(set->bo, size * sizeof(*bo));
+		if (!bo) {
+			VIV2D_ERR_MSG("_Viv2DStreamUsermem cannot track bo:%p", pix->bo);
+			return;
+		}
+		set->bo = bo;
+		set->size = size;
+	}
+
+	etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_READ | DRM_ETNA_PREP_WRITE);
+	etna_bo_cpu_fini(pix->bo);
+	set->bo[set->count++] = pix->bo;
+}
+
 static inline uint32_t Viv2DSrcConfig(Viv2DFormat *format) {
 	uint32_t src_cfg = VIVS_DE_SRC_CONFIG_SOURCE_FORMAT(format->fmt) |
 	                   VIVS_DE_SRC_CONFIG_SWIZZLE(format->swizzle) |
@@ -204,9 +286,10 @@ static inline uint32_t Viv2DSrcConfig(Viv2DFormat *format) {
 }
 
 static inline void _Viv2DStreamSrcWithFormat(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, Viv2DFormat *format) {
+	_Viv2DStreamUsermem(v2d, src);
 //	_Viv2DStreamReserve(v2d, 8);
 #if 1
-	etna_set_state_from_bo(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, ETNA_RELOC_READ);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
 	etna_load_state(v2d->stream, VIVS_DE_SRC_STRIDE, 3);
 	etna_add_state(v2d->stream, src->pitch); // VIVS_DE_SRC_STRIDE
 	etna_add_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE); // VIVS_DE_SRC_ROTATION_CONFIG
@@ -234,6 +317,18 @@ static inline void _Viv2DStreamSrc(Viv2DPtr v2d, Viv2DPixmapPrivPtr src) {
 	_Viv2DStreamSrcWithFormat( v2d,  src, &src->format);
 }
 
+#ifdef VIV2D_COPY_SRC_RELATIVE
+/* src origin is relative to each dst rect, rects with the same offset share it */
+static inline void _Viv2DStreamSrcRelative(Viv2DPtr v2d, Viv2DPixmapPrivPtr src) {
+	_Viv2DStreamUsermem(v2d, src);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
+	etna_load_state(v2d->stream, VIVS_DE_SRC_STRIDE, 3);
+	etna_add_state(v2d->stream, src->pitch); // VIVS_DE_SRC_STRIDE
+	etna_add_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE); // VIVS_DE_SRC_ROTATION_CONFIG
+	etna_add_state(v2d->stream, Viv2DSrcConfig(&src->format) | VIVS_DE_SRC_CONFIG_SRC_RELATIVE_RELATIVE); // VIVS_DE_SRC_CONFIG
+}
+#endif
+
 static inline void _Viv2DStreamSrcOrigin(Viv2DPtr v2d, int srcX, int srcY, int width, int height) {
 	etna_set_state(v2d->stream, VIVS_DE_SRC_ORIGIN, VIVS_DE_SRC_ORIGIN_X(srcX) | VIVS_DE_SRC_ORIGIN_Y(srcY)); // VIVS_DE_SRC_ORIGIN
 	etna_set_state(v2d->stream, VIVS_DE_SRC_SIZE, VIVS_DE_SRC_SIZE_X(width) | VIVS_DE_SRC_SIZE_Y(height)); // VIVS_DE_SRC_SIZE
@@ -261,10 +356,33 @@ static inline void _Viv2DStreamEmptySrc(Viv2DPtr v2d) {
 #endif
 }
 
-static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop, Viv2DRect *clip) {
+#ifdef VIV2D_SUPPORT_MONO
+/*
+ * Monochrome source, 1 bit per pixel, leftmost pixel in the most significant
+ * bit of each byte. Set bits are expanded to fg and use ROP_FG, cleared bits
+ * to bg and use ROP_BG.
+ */
+static inline void _Viv2DStreamMonoSrc(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, uint32_t fg, uint32_t bg) {
+	_Viv2DStreamUsermem(v2d, src);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
+	etna_load_state(v2d->stream, VIVS_DE_SRC_STRIDE, 3);
+	etna_add_state(v2d->stream, src->pitch); // VIVS_DE_SRC_STRIDE
+	etna_add_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE); // VIVS_DE_SRC_ROTATION_CONFIG
+	etna_add_state(v2d->stream,
+	               VIVS_DE_SRC_CONFIG_SOURCE_FORMAT(DE_FORMAT_MONOCHROME) |
+	               VIVS_DE_SRC_CONFIG_LOCATION_MEMORY |
+	               VIVS_DE_SRC_CONFIG_PACK_PACKED8 |
+	               VIVS_DE_SRC_CONFIG_PE10_SOURCE_FORMAT(DE_FORMAT_MONOCHROME)); // VIVS_DE_SRC_CONFIG
+	etna_set_state(v2d->stream, VIVS_DE_SRC_COLOR_BG, bg);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_COLOR_FG, fg);
+}
+#endif
+
+static inline void _Viv2DStreamDstRop4(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop_fg, int rop_bg, Viv2DRect *clip) {
+	_Viv2DStreamUsermem(v2d, dst);
 //	_Viv2DStreamReserve(v2d->stream, 14);
 #if 1
-	etna_set_state_from_bo(v2d->stream, VIVS_DE_DEST_ADDRESS, dst->bo, ETNA_RELOC_WRITE);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_DEST_ADDRESS, dst->bo, dst->offset, ETNA_RELOC_WRITE);
 	etna_load_state(v2d->stream, VIVS_DE_DEST_STRIDE, 3);
 	etna_add_state(v2d->stream, dst->pitch); // VIVS_DE_DEST_STRIDE
 	etna_add_state(v2d->stream, 0); // VIVS_DE_DEST_ROTATION_CONFIG
@@ -278,7 +396,7 @@ static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd
 
 	etna_load_state(v2d->stream, VIVS_DE_ROP, 3);
 	etna_add_state(v2d->stream,
-	               VIVS_DE_ROP_ROP_FG(rop) | VIVS_DE_ROP_ROP_BG(rop) | VIVS_DE_ROP_TYPE_ROP4); // VIVS_DE_ROP
+	               VIVS_DE_ROP_ROP_FG(rop_fg) | VIVS_DE_ROP_ROP_BG(rop_bg) | VIVS_DE_ROP_TYPE_ROP4); // VIVS_DE_ROP
 
 	if (clip) {
 		etna_add_state(v2d->stream,
@@ -313,7 +431,7 @@ static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd
 	               VIVS_DE_DEST_CONFIG_MINOR_TILED_DISABLE
 	              );
 	etna_set_state(v2d->stream, VIVS_DE_ROP,
-	               VIVS_DE_ROP_ROP_FG(rop) | VIVS_DE_ROP_ROP_BG(rop) | VIVS_DE_ROP_TYPE_ROP4);
+	               VIVS_DE_ROP_ROP_FG(rop_fg) | VIVS_DE_ROP_ROP_BG(rop_bg) | VIVS_DE_ROP_TYPE_ROP4);
 
 	if (clip) {
 		etna_set_state(v2d->stream, VIVS_DE_CLIP_TOP_LEFT,
@@ -342,6 +460,10 @@ static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd
 
 }
 
+static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop, Viv2DRect *clip) {
+	_Viv2DStreamDstRop4(v2d, dst, cmd, rop, rop, clip);
+}
+
 static inline void _Viv2DStreamBrushFill(Viv2DPtr v2d, uint32_t color) {
 //	_Viv2DStreamReserve(v2d, 10);
 	/*	etna_set_state(v2d->stream, VIVS_DE_PATTERN_MASK_LOW, 0xffffffff);
@@ -359,6 +481,46 @@ static inline void _Viv2DStreamBrushFill(Viv2DPtr v2d, uint32_t color) {
 	etna_set_state(v2d->stream, VIVS_DE_PATTERN_CONFIG, VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
 }
 
+/*
+ * 8x8 mono pattern, row y is byte y of low (rows 0-3) and high (rows 4-7),
+ * leftmost pixel in the most significant bit. Pattern pixel (x & 7, y & 7)
+ * is used for destination pixel (x, y), set bits are expanded to fg, cleared
+ * bits to bg.
+ */
+static inline void _Viv2DStreamBrushMono(Viv2DPtr v2d, uint32_t low, uint32_t high, uint32_t fg, uint32_t bg) {
+	etna_set_state(v2d->stream, VIVS_DE_PATTERN_LOW, low);
+
+	etna_load_state(v2d->stream, VIVS_DE_PATTERN_HIGH, 5);
+	etna_add_state(v2d->stream, high); // VIVS_DE_PATTERN_HIGH
+	etna_add_state(v2d->stream, 0xffffffff); // VIVS_DE_PATTERN_MASK_LOW
+	etna_add_state(v2d->stream, 0xffffffff); // VIVS_DE_PATTERN_MASK_HIGH
+	etna_add_state(v2d->stream, bg); // VIVS_DE_PATTERN_BG_COLOR
+	etna_add_state(v2d->stream, fg); // VIVS_DE_PATTERN_FG_COLOR
+
+	etna_set_state(v2d->stream, VIVS_DE_PATTERN_CONFIG,
+	               VIVS_DE_PATTERN_CONFIG_FORMAT(DE_FORMAT_MONOCHROME) |
+	               VIVS_DE_PATTERN_CONFIG_TYPE_PATTERN |
+	               VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+}
+
+/* 8x8 color pattern, pat holds 64 contiguous pixels in its format */
+static inline void _Viv2DStreamBrushPattern(Viv2DPtr v2d, Viv2DPixmapPrivPtr pat) {
+	_Viv2DStreamUsermem(v2d, pat);
+	etna_set_state_from_bo(v2d->stream, VIVS_DE_PATTERN_ADDRESS, pat->bo, ETNA_RELOC_READ);
+
+	etna_load_state(v2d->stream, VIVS_DE_PATTERN_HIGH, 5);
+	etna_add_state(v2d->stream, 0); // VIVS_DE_PATTERN_HIGH
+	etna_add_state(v2d->stream, 0xffffffff); // VIVS_DE_PATTERN_MASK_LOW
+	etna_add_state(v2d->stream, 0xffffffff); // VIVS_DE_PATTERN_MASK_HIGH
+	etna_add_state(v2d->stream, 0); // VIVS_DE_PATTERN_BG_COLOR
+	etna_add_state(v2d->stream, 0); // VIVS_DE_PATTERN_FG_COLOR
+
+	etna_set_state(v2d->stream, VIVS_DE_PATTERN_CONFIG,
+	               VIVS_DE_PATTERN_CONFIG_FORMAT(pat->format.fmt) |
+	               VIVS_DE_PATTERN_CONFIG_TYPE_PATTERN |
+	               VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+}
+
 
 static inline void _Viv2DStreamStretch(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr dst) {
 //	_Viv2DStreamReserve(v2d->stream, 4);
@@ -460,6 +622,54 @@ static inline void _Viv2DStreamBlendOp(Viv2DPtr v2d, Viv2DBlendOp *blend_op,
 	}
 }
 
+/*
+ * Blend with a global source color: the source alpha is scaled by the global
+ * alpha and the source color multiplied as set by multiply, one of
+ * SRC_GLOBAL_PREMULTIPLY_ALPHA or _COLOR, optionally with SRC_PREMULTIPLY.
+ * - A8 source, non premultiplied color, COLOR | SRC_PREMULTIPLY : color IN source
+ * - ARGB source, premultiplied color, COLOR : color IN source per component
+ * - ARGB source, ALPHA : source per component * color alpha
+ */
+static inline void _Viv2DStreamBlendOpGlobalColor(Viv2DPtr v2d, Viv2DBlendOp *blend_op, uint32_t color, uint32_t multiply) {
+	etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL,
+	               VIVS_DE_ALPHA_CONTROL_ENABLE_ON |
+	               VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_SRC_ALPHA(color >> 24) |
+	               VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_DST_ALPHA(0));
+
+	etna_set_state(v2d->stream, VIVS_DE_ALPHA_MODES,
+	               VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_SCALED |
+	               VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_NORMAL |
+	               VIVS_DE_ALPHA_MODES_SRC_BLENDING_MODE(blend_op->src_blend_mode) |
+	               VIVS_DE_ALPHA_MODES_DST_BLENDING_MODE(blend_op->dst_blend_mode));
+
+	etna_load_state(v2d->stream, VIVS_DE_GLOBAL_SRC_COLOR, 3);
+	etna_add_state(v2d->stream, color); // VIVS_DE_GLOBAL_SRC_COLOR
+	etna_add_state(v2d->stream, 0); // VIVS_DE_GLOBAL_DEST_COLOR
+	etna_add_state(v2d->stream, /* PE20 */
+	               multiply |
+	               VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
+	               VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE); // VIVS_DE_COLOR_MULTIPLY_MODES
+
+	VIV2D_OP_DBG_MSG("_Viv2DStreamBlendOpGlobalColor op:%s color:%x multiply:%x", pix_op_name(blend_op->op), color, multiply);
+}
+
+/* premultiplied ARGB to non premultiplied */
+static inline uint32_t Viv2DUnpremultiply(uint32_t color) {
+	uint32_t a = color >> 24;
+	uint32_t r, g, b;
+
+	if (a == 0)
+		return 0;
+	if (a == 0xff)
+		return color;
+
+	r = min(((color >> 16) & 0xff) * 0xff / a, 0xff);
+	g = min(((color >> 8) & 0xff) * 0xff / a, 0xff);
+	b = min((color & 0xff) * 0xff / a, 0xff);
+
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
 static inline void _Viv2DStreamColor(Viv2DPtr v2d, uint32_t color) {
 //	_Viv2DStreamReserve(v2d->stream, 8);
 	/* Clear color PE20 */
@@ -472,6 +682,44 @@ static inline void _Viv2DStreamColor(Viv2DPtr v2d, uint32_t color) {
 	VIV2D_OP_DBG_MSG("_Viv2DStreamColor color:%x", color);
 }
 
+static inline uint32_t Viv2DScale16(uint32_t val, int bits)
+{
+	val <<= (16 - bits);
+	while (bits < 16) {
+		val |= val >> bits;
+		bits <<= 1;
+	}
+	return val >> 8;
+}
+
+static inline uint32_t Viv2DColour(Pixel pixel, int depth) {
+	uint32_t colour;
+	switch (depth) {
+	case 15: /* A1R5G5B5 */
+		colour = (pixel & 0x8000 ? 0xff000000 : 0) |
+		         Viv2DScale16((pixel & 0x7c00) >> 10, 5) << 16 |
+		         Viv2DScale16((pixel & 0x03e0) >> 5, 5) << 8 |
+		         Viv2DScale16((pixel & 0x001f), 5);
+		break;
+	case 16: /* R5G6B5 */
+		colour = 0xff000000 |
+		         Viv2DScale16((pixel & 0xf800) >> 11, 5) << 16 |
+		         Viv2DScale16((pixel & 0x07e0) >> 5, 6) << 8 |
+		         Viv2DScale16((pixel & 0x001f), 5);
+		break;
+	case 24: /* A8R8G8B8 */
+		colour = 0xff000000 | pixel;
+		break;
+	case 8: /* A8 */
+		colour = (pixel & 0xff) << 24;
+		break;
+	default:
+		colour = pixel;
+		break;
+	}
+	return colour;
+}
+
 // higher level helpers
 
 static inline void _Viv2DStreamCacheFlush(Viv2DPtr v2d) {
@@ -589,6 +837,138 @@ static inline void _Viv2DStreamCompRects(Viv2DPtr v2d, int src_type, int x, int
 	_Viv2DStreamCacheFlush(v2d);
 }
 
+#ifdef VIV2D_COMPOSITE_BATCH
+/* stream the rects of the composite left open by DoneComposite */
+static inline void _Viv2DOpFlushPending(Viv2DPtr v2d) {
+	Viv2DOp *op = &v2d->op;
+
+	if (!op->pending)
+		return;
+
+	op->pending = FALSE;
+	if (op->cur_rect > 0) {
+		_Viv2DStreamCompRects(v2d, op->src_type,
+		                      op->prev_src_x, op->prev_src_y, op->prev_width, op->prev_height,
+		                      op->rects, op->cur_rect);
+		op->cur_rect = 0;
+	}
+}
+#endif
+
+#ifdef VIV2D_MULTI_SOURCE
+/*
+ * source i of a multi source blit at x,y, blended with blend_op onto the
+ * result of sources 0 to i-1, source 0 onto the destination.
+ */
+static inline void _Viv2DStreamMultiSrc(Viv2DPtr v2d, int i, Viv2DPixmapPrivPtr src, Viv2DFormat *format,
+                                        int x, int y, int w, int h, Viv2DBlendOp *blend_op) {
+	_Viv2DStreamUsermem(v2d, src);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_BLOCK4_SRC_ADDRESS(i), src->bo, src->offset, ETNA_RELOC_READ);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_SRC_STRIDE(i), src->pitch);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_SRC_ROTATION_CONFIG(i), VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_SRC_CONFIG(i), Viv2DSrcConfig(format));
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_SRC_ORIGIN(i), VIVS_DE_SRC_ORIGIN_X(x) | VIVS_DE_SRC_ORIGIN_Y(y));
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_SRC_SIZE(i), VIVS_DE_SRC_SIZE_X(w) | VIVS_DE_SRC_SIZE_Y(h));
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_ROP(i),
+	               VIVS_DE_ROP_ROP_FG(ROP_SRC) | VIVS_DE_ROP_ROP_BG(ROP_SRC) | VIVS_DE_ROP_TYPE_ROP4);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_ALPHA_CONTROL(i), VIVS_DE_ALPHA_CONTROL_ENABLE_ON);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_ALPHA_MODES(i),
+	               VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL |
+	               VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_NORMAL |
+	               VIVS_DE_ALPHA_MODES_SRC_BLENDING_MODE(blend_op->src_blend_mode) |
+	               VIVS_DE_ALPHA_MODES_DST_BLENDING_MODE(blend_op->dst_blend_mode));
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_GLOBAL_SRC_COLOR(i), 0);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_GLOBAL_DEST_COLOR(i), 0);
+	etna_set_state(v2d->stream, VIVS_DE_BLOCK4_COLOR_MULTIPLY_MODES(i),
+	               VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
+	               VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
+	               VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_DISABLE |
+	               VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE);
+}
+
+static inline void _Viv2DStreamMultiSource(Viv2DPtr v2d, int count) {
+	etna_set_state(v2d->stream, VIVS_DE_DE_MULTI_SOURCE,
+	               VIVS_DE_DE_MULTI_SOURCE_MAX_SOURCE(count - 1) |
+	               VIVS_DE_DE_MULTI_SOURCE_HORIZONTAL_BLOCK_PIXEL128 |
+	               VIVS_DE_DE_MULTI_SOURCE_VERTICAL_BLOCK_LINE1);
+}
+#endif
+
+// tiling
+
+static inline Bool _Viv2DPixIsLarge(Viv2DPixmapPrivPtr pix) {
+	return pix && (pix->width > VIV2D_HW_MAX_SIZE || pix->height > VIV2D_HW_MAX_SIZE);
+}
+
+/* width x height part of pix at x,y seen as a pixmap of its own */
+static inline void _Viv2DPixView(Viv2DPixmapPrivPtr pix, Viv2DPixmapPrivPtr view, int x, int y, int width, int height) {
+	*view = *pix;
+	view->offset = pix->offset + y * pix->pitch + x * pix->format.bpp / 8;
+	view->width = width;
+	view->height = height;
+}
+
+/*
+ * _Viv2DStreamCompAlpha for one rect of dst, src at x,y. When dst or src are
+ * over VIV2D_HW_MAX_SIZE, dst is split in tiles of half the max size, the
+ * rect is clipped to each tile and the src read from a view starting at the
+ * aligned left of the clipped part, so that it also fits.
+ */
+static inline void _Viv2DStreamCompTiled(Viv2DPtr v2d, int src_type, Viv2DPixmapPrivPtr src, Viv2DFormat *src_fmt, int color,
+        Viv2DPixmapPrivPtr dst, Viv2DBlendOp *blend_op,
+        Bool src_global, uint8_t src_alpha,
+        Bool dst_global, uint8_t dst_alpha,
+        int x, int y, Viv2DRect *rect) {
+	int step = VIV2D_HW_MAX_SIZE / 2;
+	Viv2DPixmapPrivRec dst_view, src_view;
+	Viv2DPixmapPrivPtr srcv;
+	Viv2DRect piece;
+	int tx, ty, sx, sy, vx, align;
+
+	if (!_Viv2DPixIsLarge(dst) && !(src_type == viv2d_src_pix && _Viv2DPixIsLarge(src))) {
+		_Viv2DStreamCompAlpha(v2d, src_type, src, src_fmt, color, dst, blend_op,
+		                      src_global, src_alpha, dst_global, dst_alpha,
+		                      x, y, rect->x2 - rect->x1, rect->y2 - rect->y1, rect, 1);
+		return;
+	}
+
+	for (ty = rect->y1 - rect->y1 % step; ty < rect->y2; ty += step) {
+		for (tx = rect->x1 - rect->x1 % step; tx < rect->x2; tx += step) {
+			piece.x1 = max(rect->x1, tx);
+			piece.y1 = max(rect->y1, ty);
+			piece.x2 = min(rect->x2, tx + step);
+			piece.y2 = min(rect->y2, ty + step);
+			if (piece.x1 >= piece.x2 || piece.y1 >= piece.y2)
+				continue;
+
+			sx = x + piece.x1 - rect->x1;
+			sy = y + piece.y1 - rect->y1;
+
+			srcv = src;
+			if (src_type == viv2d_src_pix && _Viv2DPixIsLarge(src)) {
+				align = VIV2D_ADDRESS_ALIGN * 8 / src->format.bpp;
+				vx = sx - sx % align;
+				_Viv2DPixView(src, &src_view, vx, sy,
+				              min(VIV2D_HW_MAX_SIZE, src->width - vx), min(VIV2D_HW_MAX_SIZE, src->height - sy));
+				srcv = &src_view;
+				sx -= vx;
+				sy = 0;
+			}
+
+			_Viv2DPixView(dst, &dst_view, tx, ty, min(step, dst->width - tx), min(step, dst->height - ty));
+
+			piece.x1 -= tx;
+			piece.y1 -= ty;
+			piece.x2 -= tx;
+			piece.y2 -= ty;
+
+			_Viv2DStreamCompAlpha(v2d, src_type, srcv, src_fmt, color, &dst_view, blend_op,
+			                      src_global, src_alpha, dst_global, dst_alpha,
+			                      sx, sy, piece.x2 - piece.x1, piece.y2 - piece.y1, &piece, 1);
+		}
+	}
+}
+
 static inline void _Viv2DStreamClear(Viv2DPtr v2d, Viv2DPixmapPrivPtr pix) {
 	if (pix && pix->bo) {
 		Viv2DRect rect[1];
@@ -611,7 +991,7 @@ static inline Viv2DPixmapPrivPtr _Viv2DOpCreateTmpPix(Viv2DPtr v2d, int width, i
 	int pitch;
 
 	tmp = calloc(sizeof(*tmp), 1);
-	pitch = ALIGN(width * ((bpp + 7) / 8), VIV2D_PITCH_ALIGN);
+	pitch = ALIGN((width * bpp + 7) / 8, VIV2D_PITCH_ALIGN);
 	tmp->bo = etna_bo_cache_new(v2d->dev, pitch * height, ETNA_BO_WC);
 
 	VIV2D_OP_DBG_MSG("_Viv2DOpCreateTmpPix bo:%p %dx%d %d", tmp->bo, width, height, pitch * height);
@@ -0,0 +1,340 @@
+
+/*
+ * Copyright © 2016 Julien Boulnois
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+
+#include "picturestr.h"
+#include "mipict.h"
+
+#include "armsoc_driver.h"
+#include "armsoc_exa.h"
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "exa.h"
+
+#include "viv2d.h"
+#include "viv2d_exa.h"
+#include "viv2d_op.h"
+
+#include "viv2d_config.h"
+
+#ifdef VIV2D_TRAPEZOID_MASK
+
+/*
+The EXA hack renders trapezoids and triangles with fb straight into the
+destination, which syncs the GPU and blends on the CPU in write combined
+memory. Instead, the coverage of the shapes inside the destination is
+rasterised by pixman into an A8 scratch mask in a cached bo, then the source
+is composited through it on the GPU, like miTrapezoids does with a temporary
+mask. Two scratch masks are used in turn so the CPU can rasterise the next
+shapes while the GPU reads the previous mask.
+*/
+
+#define VIV2D_TRAP_MASKS 2
+#define VIV2D_TRAP_MASK_MAX VIV2D_HW_MAX_SIZE
+
+typedef struct _Viv2DTrapMask {
+	PicturePtr pict[VIV2D_TRAP_MASKS];
+	int width;
+	int height;
+	int next;
+} Viv2DTrapMask;
+
+static void Viv2DTrapMaskFree(Viv2DTrapMask *mask) {
+	int i;
+
+	for (i = 0; i < VIV2D_TRAP_MASKS; i++) {
+		if (mask->pict[i])
+			FreePicture(mask->pict[i], 0);
+		mask->pict[i] = NULL;
+	}
+	mask->width = 0;
+	mask->height = 0;
+}
+
+/* masks only grow, to the largest shapes drawn so far */
+static Bool Viv2DTrapMaskAlloc(ScreenPtr pScreen, Viv2DTrapMask *mask, int width, int height) {
+	PictFormatPtr pFormat = PictureMatchFormat(pScreen, 8, PICT_a8);
+	PixmapPtr pPixmap;
+	int error, i;
+
+	if (!pFormat)
+		return FALSE;
+
+	width = max(ALIGN(width, 64), mask->width);
+	height = max(ALIGN(height, 64), mask->height);
+	Viv2DTrapMaskFree(mask);
+
+	for (i = 0; i < VIV2D_TRAP_MASKS; i++) {
+		pPixmap = pScreen->CreatePixmap(pScreen, width, height, 8, VIV2D_CREATE_PIXMAP_CACHED);
+		if (!pPixmap)
+			break;
+		// the picture holds a ref
+		mask->pict[i] = CreatePicture(0, &pPixmap->drawable, pFormat, 0, NULL, serverClient, &error);
+		pScreen->DestroyPixmap(pPixmap);
+		if (!mask->pict[i])
+			break;
+	}
+
+	if (i < VIV2D_TRAP_MASKS) {
+		Viv2DTrapMaskFree(mask);
+		return FALSE;
+	}
+
+	mask->width = width;
+	mask->height = height;
+	return TRUE;
+}
+
+/* next scratch mask, ready for CPU writes */
+static PicturePtr Viv2DTrapMaskGet(ScreenPtr pScreen, Viv2DPtr v2d, Viv2DTrapMask *mask, int width, int height,
+                                   struct etna_bo **bo, char **bits, int *pitch) {
+	struct ARMSOCPixmapPrivRec *armsocPix;
+	PicturePtr pict;
+
+	if (width > mask->width || height > mask->height) {
+		if (!Viv2DTrapMaskAlloc(pScreen, mask, width, height))
+			return NULL;
+	}
+
+	pict = mask->pict[mask->next];
+	mask->next = (mask->next + 1) % VIV2D_TRAP_MASKS;
+
+	armsocPix = exaGetPixmapDriverPrivate((PixmapPtr)pict->pDrawable);
+	*bo = Viv2DPixmapPrivFromPixmap((PixmapPtr)pict->pDrawable)->bo;
+	if (!*bo || !armsocPix->buf.cached)
+		return NULL;
+
+	if (!etna_bo_ready(*bo))
+		_Viv2DStreamCommit(v2d, TRUE);
+	etna_bo_cpu_prep(*bo, DRM_ETNA_PREP_WRITE);
+
+	*bits = armsocPix->buf.buf;
+	*pitch = armsocPix->buf.pitch;
+	return pict;
+}
+
+static Bool Viv2DShapesMask(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                            INT16 xSrc, INT16 ySrc, int xDst, int yDst, BoxPtr bounds,
+                            int n, void *shapes, Bool triangles) {
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+	pixman_image_t *image;
+	struct etna_bo *bo;
+	PicturePtr pMask;
+	BoxRec box;
+	char *bits;
+	int pitch, width, height, y;
+
+	if (!v2d->trap_mask || !maskFormat || maskFormat->format != PICT_a8)
+		return FALSE;
+
+	// only the part of the shapes inside the destination
+	box.x1 = max(bounds->x1, 0);
+	box.y1 = max(bounds->y1, 0);
+	box.x2 = min(bounds->x2, pDst->pDrawable->width);
+	box.y2 = min(bounds->y2, pDst->pDrawable->height);
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		return TRUE;
+
+	width = box.x2 - box.x1;
+	height = box.y2 - box.y1;
+	if (width > VIV2D_TRAP_MASK_MAX || height > VIV2D_TRAP_MASK_MAX)
+		return FALSE;
+
+	pMask = Viv2DTrapMaskGet(pScreen, v2d, v2d->trap_mask, width, height, &bo, &bits, &pitch);
+	if (!pMask)
+		return FALSE;
+
+	for (y = 0; y < height; y++)
+		memset(bits + y * pitch, 0, width);
+
+	image = pixman_image_create_bits(PIXMAN_a8, width, height, (uint32_t *)bits, pitch);
+	if (image) {
+		if (triangles)
+			pixman_add_triangles(image, -box.x1, -box.y1, n, (pixman_triangle_t *)shapes);
+		else
+			pixman_add_trapezoids(image, -box.x1, -box.y1, n, (pixman_trapezoid_t *)shapes);
+		pixman_image_unref(image);
+	}
+	etna_bo_cpu_fini(bo);
+
+	if (!image)
+		return FALSE;
+
+	CompositePicture(op, pSrc, pMask, pDst,
+	                 box.x1 + xSrc - xDst, box.y1 + ySrc - yDst, 0, 0,
+	                 box.x1, box.y1, width, height);
+	return TRUE;
+}
+
+#ifdef VIV2D_TRAPEZOID_RECTS
+/* box of a trapezoid covering whole pixels : integer top, bottom and vertical edges */
+static inline Bool Viv2DTrapBox(xTrapezoid *trap, BoxPtr box) {
+	if ((trap->top | trap->bottom) & 0xffff)
+		return FALSE;
+	if (trap->left.p1.x != trap->left.p2.x || trap->right.p1.x != trap->right.p2.x)
+		return FALSE;
+	if ((trap->left.p1.x | trap->right.p1.x) & 0xffff)
+		return FALSE;
+
+	box->x1 = trap->left.p1.x >> 16;
+	box->y1 = trap->top >> 16;
+	box->x2 = trap->right.p1.x >> 16;
+	box->y2 = trap->bottom >> 16;
+	return TRUE;
+}
+
+/*
+ * pixel aligned trapezoids, box fills and clip rects without antialiasing,
+ * are composited as plain rects, no mask at all. With a mask format the
+ * coverage saturates, overlapping boxes are drawn once through their union;
+ * only for ops keeping dst where the mask is zero, the bounds outside the
+ * union are not drawn. Without a mask format, each trapezoid is composited on
+ * its own with the source origin at its own left.p1, as fb does.
+ */
+static Bool Viv2DTrapezoidsRects(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                                 INT16 xSrc, INT16 ySrc, int ntrap, xTrapezoid *traps) {
+	int xDst = traps[0].left.p1.x >> 16;
+	int yDst = traps[0].left.p1.y >> 16;
+	RegionRec region;
+	BoxPtr boxes, pbox;
+	int i, n;
+
+	// the mask covers the bounds, ops changing dst under a zero mask need all of it
+	if (maskFormat && !Viv2DOpKeepsDst(op))
+		return FALSE;
+
+	boxes = malloc(ntrap * sizeof(*boxes));
+	if (!boxes)
+		return FALSE;
+
+	for (i = 0; i < ntrap; i++) {
+		if (!Viv2DTrapBox(&traps[i], &boxes[i])) {
+			free(boxes);
+			return FALSE;
+		}
+	}
+
+	if (!maskFormat) {
+		for (i = 0; i < ntrap; i++) {
+			pbox = &boxes[i];
+			if (pbox->x1 >= pbox->x2 || pbox->y1 >= pbox->y2)
+				continue;
+			xDst = traps[i].left.p1.x >> 16;
+			yDst = traps[i].left.p1.y >> 16;
+			CompositePicture(op, pSrc, NULL, pDst,
+			                 xSrc + pbox->x1 - xDst, ySrc + pbox->y1 - yDst, 0, 0,
+			                 pbox->x1, pbox->y1, pbox->x2 - pbox->x1, pbox->y2 - pbox->y1);
+		}
+		free(boxes);
+		return TRUE;
+	}
+
+	// empty boxes are dropped from the union
+	for (i = 0, n = 0; i < ntrap; i++) {
+		if (boxes[i].x1 < boxes[i].x2 && boxes[i].y1 < boxes[i].y2)
+			boxes[n++] = boxes[i];
+	}
+
+	RegionInitBoxes(&region, boxes, n);
+	pbox = RegionRects(&region);
+	n = RegionNumRects(&region);
+
+	for (i = 0; i < n; i++) {
+		CompositePicture(op, pSrc, NULL, pDst,
+		                 xSrc + pbox[i].x1 - xDst, ySrc + pbox[i].y1 - yDst, 0, 0,
+		                 pbox[i].x1, pbox[i].y1, pbox[i].x2 - pbox[i].x1, pbox[i].y2 - pbox[i].y1);
+	}
+
+	RegionUninit(&region);
+	free(boxes);
+	return TRUE;
+}
+#endif
+
+Bool Viv2DTrapezoidsMask(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                         INT16 xSrc, INT16 ySrc, int ntrap, xTrapezoid *traps) {
+	BoxRec bounds;
+
+	if (ntrap <= 0)
+		return FALSE;
+
+#ifdef VIV2D_TRAPEZOID_RECTS
+	if (Viv2DTrapezoidsRects(op, pSrc, pDst, maskFormat, xSrc, ySrc, ntrap, traps))
+		return TRUE;
+#endif
+
+	miTrapezoidBounds(ntrap, traps, &bounds);
+	return Viv2DShapesMask(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+	                       traps[0].left.p1.x >> 16, traps[0].left.p1.y >> 16,
+	                       &bounds, ntrap, traps, FALSE);
+}
+
+Bool Viv2DTrianglesMask(CARD8 op, PicturePtr pSrc, PicturePtr pDst, PictFormatPtr maskFormat,
+                        INT16 xSrc, INT16 ySrc, int ntri, xTriangle *tris) {
+	BoxRec bounds;
+
+	if (ntri <= 0)
+		return FALSE;
+
+	miTriangleBounds(ntri, tris, &bounds);
+	return Viv2DShapesMask(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+	                       tris[0].p1.x >> 16, tris[0].p1.y >> 16,
+	                       &bounds, ntri, tris, TRUE);
+}
+
+Bool Viv2DTrapScreenInit(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+
+	if (!GetPictureScreenIfSet(pScreen))
+		return TRUE;
+
+	v2d->trap_mask = calloc(1, sizeof(*v2d->trap_mask));
+	return v2d->trap_mask != NULL;
+}
+
+void Viv2DTrapScreenFini(ScreenPtr pScreen) {
+	Viv2DPtr v2d = Viv2DPrivFromScreen(pScreen);
+
+	if (!v2d->trap_mask)
+		return;
+
+	Viv2DTrapMaskFree(v2d->trap_mask);
+	free(v2d->trap_mask);
+	v2d->trap_mask = NULL;
+}
+#endif